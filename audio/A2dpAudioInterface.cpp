@@ -15,11 +15,15 @@
  */
 
 #include <math.h>
+#include <time.h>
+#include <errno.h>
 
 //#define LOG_NDEBUG 0
 #define LOG_TAG "A2dpAudioInterface"
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include "A2dpAudioInterface.h"
 #include "audio/liba2dp.h"
@@ -30,6 +34,8 @@ namespace android_audio_legacy {
 
 static const char *sA2dpWakeLock = "A2dpOutputStream";
 #define MAX_WRITE_RETRIES  5
+// maximum time to wait for the ring to drain on standby
+#define RING_DRAIN_TIMEOUT_MS  500
 
 // ----------------------------------------------------------------------------
 
@@ -225,7 +231,11 @@ A2dpAudioInterface::A2dpAudioStreamOut::A2dpAudioStreamOut() :
     mFd(-1), mStandby(true), mStartCount(0), mRetryCount(0), mData(NULL),
     // assume BT enabled to start, this is safe because its only the
     // enabled->disabled transition we are worried about
-    mBluetoothEnabled(true), mDevice(0), mClosing(false), mSuspended(false)
+    mBluetoothEnabled(true), mDevice(0), mClosing(false), mSuspended(false),
+    mBufferDurationUs(0), mStartTime(0), mFramesWritten(0), mErrorPaceTime(0),
+    mDrift(0), mResyncCount(0), mStandbyStartTime(systemTime()), mStandbyTime(0),
+    mFramesTransmitted(0), mLastTransmitTime(0), mFramesDropped(0), mFramesPresented(0),
+    mRing(NULL), mRingActive(0), mUnderruns(0), mOverruns(0)
 {
     // use any address by default
     strcpy(mA2dpAddress, "00:00:00:00:00:00");
@@ -262,77 +272,294 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::set(
 
     mDevice = device;
     mBufferDurationUs = ((bufferSize() * 1000 )/ frameSize() / sampleRate()) * 1000;
+
+    if (AudioRingBuffer::isEnabled("audio.a2dp.async_write") && mTransmitThread == 0) {
+        char value[PROPERTY_VALUE_MAX];
+        property_get("audio.a2dp.async_depth", value, "0");
+        int count = atoi(value);
+        if (count <= 0) {
+            count = kDefaultAsyncBufferCount;
+        } else if (count > kMaxAsyncBufferCount) {
+            count = kMaxAsyncBufferCount;
+        }
+        mRing = new AudioRingBuffer(bufferSize() * count);
+        mTransmitThread = new TransmitThread(this);
+        if (mTransmitThread->run("A2dpTransmit", android::PRIORITY_URGENT_AUDIO) != NO_ERROR) {
+            ALOGW("set() cannot start transmit thread, using synchronous writes");
+            mTransmitThread.clear();
+            delete mRing;
+            mRing = NULL;
+        }
+    }
     return NO_ERROR;
 }
 
 A2dpAudioInterface::A2dpAudioStreamOut::~A2dpAudioStreamOut()
 {
     ALOGV("A2dpAudioStreamOut destructor");
+    stopTransmitThread();
     close();
+    delete mRing;
     ALOGV("A2dpAudioStreamOut destructor returning from close()");
 }
 
 ssize_t A2dpAudioInterface::A2dpAudioStreamOut::write(const void* buffer, size_t bytes)
 {
     status_t status = -1;
+    nsecs_t deadline;
     {
         Mutex::Autolock lock(mLock);
 
-        size_t remaining = bytes;
-
         if (!mBluetoothEnabled || mClosing || mSuspended) {
             ALOGV("A2dpAudioStreamOut::write(), but bluetooth disabled \
                    mBluetoothEnabled %d, mClosing %d, mSuspended %d",
                     mBluetoothEnabled, mClosing, mSuspended);
+            updateTransmitted(0, bytes);
             goto Error;
         }
 
         if (mStandby) {
             acquire_wake_lock (PARTIAL_WAKE_LOCK, sA2dpWakeLock);
             mStandby = false;
-            mLastWriteTime = systemTime();
+            mStartTime = systemTime();
+            mStandbyTime += mStartTime - mStandbyStartTime;
+            mFramesWritten = 0;
+            Mutex::Autolock positionLock(mPositionLock);
+            mFramesTransmitted = 0;
+            mFramesPresented = 0;
         }
 
-        status = init();
-        if (status < 0)
-            goto Error;
-
-        int retries = MAX_WRITE_RETRIES;
-        while (remaining > 0 && retries) {
-            status = a2dp_write(mData, buffer, remaining);
-            if (status < 0) {
-                ALOGE("a2dp_write failed err: %d\n", status);
+        // in asynchronous mode, encoding and transmission are done by mTransmitThread
+        if (mTransmitThread == 0) {
+            status = transmit_l(buffer, bytes);
+            if (status < 0)
                 goto Error;
-            }
-            if (status == 0) {
-                retries--;
-            }
-            remaining -= status;
-            buffer = (char *)buffer + status;
-        }
-
-        // if A2DP sink runs abnormally fast, sleep a little so that audioflinger mixer thread
-        // does no spin and starve other threads.
-        // NOTE: It is likely that the A2DP headset is being disconnected
-        nsecs_t now = systemTime();
-        if ((uint32_t)ns2us(now - mLastWriteTime) < (mBufferDurationUs >> 2)) {
-            ALOGV("A2DP sink runs too fast");
-            usleep(mBufferDurationUs - (uint32_t)ns2us(now - mLastWriteTime));
         }
-        mLastWriteTime = now;
-        return bytes;
 
+        mErrorPaceTime = 0;
+        mFramesWritten += bytes / frameSize();
+        deadline = pacingDeadline_l(systemTime());
     }
+    // queue without holding mLock, which mTransmitThread needs to make room
+    if (mTransmitThread != 0) {
+        queue(buffer, bytes);
+    }
+    // if A2DP sink runs abnormally fast, sleep so that audioflinger mixer thread
+    // does not spin and starve other threads. mLock is not held so that standby()
+    // and parameter changes are not delayed.
+    // NOTE: It is likely that the A2DP headset is being disconnected
+    if (deadline != 0) {
+        ALOGV("A2DP sink runs too fast");
+        sleepUntil(deadline);
+    }
+    return bytes;
+
 Error:
 
     standby();
 
-    // Simulate audio output timing in case of error
-    usleep(mBufferDurationUs);
+    // Simulate audio output timing in case of error. Successive failed writes follow
+    // an absolute schedule so that the time spent failing does not add up.
+    nsecs_t now = systemTime();
+    if (mErrorPaceTime < now) {
+        mErrorPaceTime = now;
+    }
+    mErrorPaceTime += framesToNs(bytes / frameSize());
+    sleepUntil(mErrorPaceTime);
+
+    return status;
+}
+
+// Encodes and sends one buffer to the sink, retrying while the sink accepts nothing.
+// What the sink did not accept is counted as dropped.
+status_t A2dpAudioInterface::A2dpAudioStreamOut::transmit_l(const void* buffer, size_t bytes)
+{
+    status_t status = init();
+    if (status < 0) {
+        updateTransmitted(0, bytes);
+        return status;
+    }
+
+    size_t remaining = bytes;
+    int retries = MAX_WRITE_RETRIES;
+    while (remaining > 0 && retries) {
+        status = a2dp_write(mData, buffer, remaining);
+        if (status < 0) {
+            ALOGE("a2dp_write failed err: %d\n", status);
+            break;
+        }
+        if (status == 0) {
+            retries--;
+        }
+        remaining -= status;
+        buffer = (char *)buffer + status;
+    }
+    updateTransmitted(bytes - remaining, remaining);
+    return status;
+}
+
+void A2dpAudioInterface::A2dpAudioStreamOut::updateTransmitted(size_t sentBytes,
+                                                                size_t droppedBytes)
+{
+    Mutex::Autolock _l(mPositionLock);
+    if (sentBytes != 0) {
+        mFramesTransmitted += sentBytes / frameSize();
+        mLastTransmitTime = systemTime();
+    }
+    mFramesDropped += droppedBytes / frameSize();
+}
+
+// The sink does not report its play position: assume it holds kSinkLatencyMs of audio when
+// it accepts data and plays it out in real time until the next transmit.
+uint32_t A2dpAudioInterface::A2dpAudioStreamOut::sinkQueuedFrames_l(nsecs_t now) const
+{
+    uint64_t queued = (uint64_t)kSinkLatencyMs * sampleRate() / 1000;
+    uint64_t played = (uint64_t)(now - mLastTransmitTime) * sampleRate() / 1000000000LL;
+    if (played >= queued) {
+        return 0;
+    }
+    queued -= played;
+    return (uint32_t)(queued < mFramesTransmitted ? queued : mFramesTransmitted);
+}
 
+// Called by mTransmitThread: data is dropped if the sink is not available. mLock is not held
+// while sending so that write() is not blocked by a congested link.
+status_t A2dpAudioInterface::A2dpAudioStreamOut::transmit(const void* buffer, size_t bytes)
+{
+    {
+        Mutex::Autolock lock(mLock);
+        if (!mBluetoothEnabled || mClosing || mSuspended) {
+            updateTransmitted(0, bytes);
+            return INVALID_OPERATION;
+        }
+        status_t status = init();
+        if (status < 0) {
+            updateTransmitted(0, bytes);
+            return status;
+        }
+    }
+
+    Mutex::Autolock lock(mTransmitLock);
+    if (mData == NULL) {
+        updateTransmitted(0, bytes);
+        return INVALID_OPERATION;
+    }
+    status_t status = transmit_l(buffer, bytes);
+    if (status < 0) {
+        // restart the sink on next transmit. The stream does not go to standby so that
+        // write() keeps its schedule.
+        a2dp_stop(mData);
+    }
     return status;
 }
 
+// Copies into the ring for mTransmitThread. If the ring is full, waits at most the duration
+// of the data for free space, then drops what does not fit: the mixer is not held up longer
+// by radio congestion.
+void A2dpAudioInterface::A2dpAudioStreamOut::queue(const void* buffer, size_t bytes)
+{
+    const uint8_t *src = (const uint8_t *)buffer;
+    size_t remaining = bytes;
+    nsecs_t timeout = systemTime() + framesToNs(bytes / frameSize());
+
+    while (remaining > 0) {
+        size_t count = mRing->write(src, remaining);
+        if (count == 0) {
+            if (!mRing->waitForSpace(timeout)) {
+                mOverruns++;
+                updateTransmitted(0, remaining);
+                return;
+            }
+            continue;
+        }
+        src += count;
+        remaining -= count;
+        if (android_atomic_acquire_load(&mRingActive) == 0) {
+            android_atomic_release_store(1, &mRingActive);
+        }
+    }
+}
+
+void A2dpAudioInterface::A2dpAudioStreamOut::stopTransmitThread()
+{
+    if (mTransmitThread == 0) {
+        return;
+    }
+    mTransmitThread->requestExit();
+    mRing->abort();
+    mTransmitThread->requestExitAndWait();
+    mTransmitThread.clear();
+}
+
+bool A2dpAudioInterface::A2dpAudioStreamOut::TransmitThread::threadLoop()
+{
+    A2dpAudioStreamOut *out = mOutput;
+    const uint8_t *data;
+    size_t count = out->mRing->readBuffer(&data, out->bufferSize());
+
+    if (count == 0) {
+        // the sink starves if all audio written has been played
+        bool late;
+        {
+            Mutex::Autolock lock(out->mLock);
+            late = !out->mStandby &&
+                    systemTime() > out->mStartTime + out->framesToNs(out->mFramesWritten);
+        }
+        if (late && android_atomic_release_cas(1, 0, &out->mRingActive) == 0) {
+            out->mUnderruns++;
+        }
+        return out->mRing->waitForData() && !exitPending();
+    }
+
+    // on error the data is dropped: write() keeps pacing the mixer
+    out->transmit(data, count);
+    out->mRing->advanceRead(count);
+    return true;
+}
+
+// Returns the time write() must sleep until to keep a real time cadence, 0 if it must not
+// sleep. Frames written since standby are scheduled from mStartTime: the writer may run
+// ahead of this schedule by up to latency(), the audio queued in the sink. In asynchronous
+// mode the transmit thread is held back by the sink instead, so the writer may only run
+// ahead by what the ring holds, less one buffer of margin. If the sink stalls for more than
+// one buffer, the schedule is shifted instead of letting the writer burst to catch up.
+nsecs_t A2dpAudioInterface::A2dpAudioStreamOut::pacingDeadline_l(nsecs_t now)
+{
+    nsecs_t scheduled = mStartTime + framesToNs(mFramesWritten);
+    nsecs_t late = now - scheduled;
+
+    if (late > (nsecs_t)us2ns(mBufferDurationUs)) {
+        ALOGV("A2DP sink stalled for %lld us", (long long)ns2us(late));
+        mStartTime += late;
+        mDrift += late;
+        mResyncCount++;
+        return 0;
+    }
+    nsecs_t lead;
+    if (mTransmitThread != 0) {
+        lead = framesToNs((mRing->size() - bufferSize()) / frameSize());
+    } else {
+        lead = ms2ns(latency());
+    }
+    nsecs_t deadline = scheduled - lead;
+    return deadline > now ? deadline : 0;
+}
+
+nsecs_t A2dpAudioInterface::A2dpAudioStreamOut::framesToNs(uint64_t frames) const
+{
+    return (nsecs_t)(frames / sampleRate()) * 1000000000LL +
+            (nsecs_t)(frames % sampleRate()) * 1000000000LL / sampleRate();
+}
+
+void A2dpAudioInterface::A2dpAudioStreamOut::sleepUntil(nsecs_t deadline)
+{
+    struct timespec ts;
+    ts.tv_sec = deadline / 1000000000LL;
+    ts.tv_nsec = deadline % 1000000000LL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+    }
+}
+
 status_t A2dpAudioInterface::A2dpAudioStreamOut::init()
 {
     if (!mData) {
@@ -350,6 +577,13 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::init()
 
 status_t A2dpAudioInterface::A2dpAudioStreamOut::standby()
 {
+    if (mTransmitThread != 0) {
+        if (!mRing->waitForEmpty(systemTime() + milliseconds(RING_DRAIN_TIMEOUT_MS))) {
+            ALOGW("standby() ring not drained");
+        }
+        // an empty ring in standby is not an underrun
+        android_atomic_release_store(0, &mRingActive);
+    }
     Mutex::Autolock lock(mLock);
     return standby_l();
 }
@@ -362,10 +596,12 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::standby_l()
         ALOGV_IF(mClosing || !mBluetoothEnabled, "Standby skip stop: closing %d enabled %d",
                 mClosing, mBluetoothEnabled);
         if (!mClosing && mBluetoothEnabled) {
+            Mutex::Autolock lock(mTransmitLock);
             result = a2dp_stop(mData);
         }
         release_wake_lock(sA2dpWakeLock);
         mStandby = true;
+        mStandbyStartTime = systemTime();
     }
 
     return result;
@@ -440,8 +676,10 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::setAddress(const char* address)
         return -EINVAL;
 
     strcpy(mA2dpAddress, address);
-    if (mData)
+    if (mData) {
+        Mutex::Autolock transmitLock(mTransmitLock);
         a2dp_set_sink(mData, mA2dpAddress);
+    }
 
     return NO_ERROR;
 }
@@ -479,6 +717,7 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::close_l()
     standby_l();
     if (mData) {
         ALOGV("A2dpAudioStreamOut::close_l() calling a2dp_cleanup(mData)");
+        Mutex::Autolock lock(mTransmitLock);
         a2dp_cleanup(mData);
         mData = NULL;
     }
@@ -487,13 +726,82 @@ status_t A2dpAudioInterface::A2dpAudioStreamOut::close_l()
 
 status_t A2dpAudioInterface::A2dpAudioStreamOut::dump(int fd, const Vector<String16>& args)
 {
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    Mutex::Autolock lock(mLock);
+    snprintf(buffer, SIZE, "A2dpAudioStreamOut::dump\n");
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tstandby: %d frames written: %llu\n",
+            mStandby, (unsigned long long)mFramesWritten);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tschedule resyncs: %u drift: %lld us\n",
+            mResyncCount, (long long)ns2us(mDrift));
+    result.append(buffer);
+    nsecs_t standbyTime = mStandbyTime;
+    if (mStandby) {
+        standbyTime += systemTime() - mStandbyStartTime;
+    }
+    snprintf(buffer, SIZE, "\ttime in standby: %lld ms\n", (long long)ns2ms(standbyTime));
+    result.append(buffer);
+    {
+        Mutex::Autolock _l(mPositionLock);
+        snprintf(buffer, SIZE, "\tframes transmitted: %llu frames dropped: %u\n",
+                (unsigned long long)mFramesTransmitted, mFramesDropped);
+        result.append(buffer);
+    }
+    if (mTransmitThread != 0) {
+        snprintf(buffer, SIZE, "\tasync ring: %u/%u bytes underruns: %u overruns: %u\n",
+                (uint32_t)mRing->filled(), (uint32_t)mRing->size(), mUnderruns, mOverruns);
+        result.append(buffer);
+    }
+    ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
 
+// Frames transmitted since standby, less the estimated audio still buffered in the sink.
 status_t A2dpAudioInterface::A2dpAudioStreamOut::getRenderPosition(uint32_t *driverFrames)
 {
-    //TODO: enable when supported by driver
-    return INVALID_OPERATION;
+    if (driverFrames == NULL) {
+        return BAD_VALUE;
+    }
+    Mutex::Autolock _l(mPositionLock);
+    uint64_t position = mFramesTransmitted - sinkQueuedFrames_l(systemTime());
+    // after a transmit gap the sink queue estimate restarts from kSinkLatencyMs: never go
+    // backwards
+    if (position > mFramesPresented) {
+        mFramesPresented = position;
+    }
+    *driverFrames = (uint32_t)mFramesPresented;
+    return NO_ERROR;
+}
+
+// Returns the monotonic time in microseconds at which the data passed to the next write()
+// will start playing: after what the sink and, in asynchronous mode, the ring still hold.
+status_t A2dpAudioInterface::A2dpAudioStreamOut::getNextWriteTimestamp(int64_t *timestamp)
+{
+    if (timestamp == NULL) {
+        return BAD_VALUE;
+    }
+    {
+        Mutex::Autolock lock(mLock);
+        if (mStandby) {
+            // start time depends on when the sink restarts
+            return INVALID_OPERATION;
+        }
+    }
+    nsecs_t now = systemTime();
+    uint64_t queued;
+    {
+        Mutex::Autolock _l(mPositionLock);
+        queued = sinkQueuedFrames_l(now);
+    }
+    if (mTransmitThread != 0) {
+        queued += mRing->filled() / frameSize();
+    }
+    *timestamp = ns2us(now + framesToNs(queued));
+    return NO_ERROR;
 }
 
 }; // namespace android
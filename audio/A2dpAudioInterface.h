@@ -24,9 +24,13 @@
 
 #include <hardware_legacy/AudioHardwareBase.h>
 
+#include "AudioRingBuffer.h"
 
 namespace android_audio_legacy {
     using android::Mutex;
+    using android::Condition;
+    using android::Thread;
+    using android::sp;
 
 class A2dpAudioInterface : public AudioHardwareBase
 {
@@ -87,7 +91,7 @@ private:
         virtual size_t      bufferSize() const { return 512 * 20; }
         virtual uint32_t    channels() const { return AudioSystem::CHANNEL_OUT_STEREO; }
         virtual int         format() const { return AudioSystem::PCM_16_BIT; }
-        virtual uint32_t    latency() const { return ((1000*bufferSize())/frameSize())/sampleRate() + 200; }
+        virtual uint32_t    latency() const { return ((1000*(bufferSize() + ringSize()))/frameSize())/sampleRate() + kSinkLatencyMs; }
         virtual status_t    setVolume(float left, float right) { return INVALID_OPERATION; }
         virtual ssize_t     write(const void* buffer, size_t bytes);
                 status_t    standby();
@@ -95,8 +99,26 @@ private:
         virtual status_t    setParameters(const String8& keyValuePairs);
         virtual String8     getParameters(const String8& keys);
         virtual status_t    getRenderPosition(uint32_t *dspFrames);
+        virtual status_t    getNextWriteTimestamp(int64_t *timestamp);
 
     private:
+        // encodes and transmits the ring buffer content in asynchronous write mode
+        class TransmitThread : public Thread {
+        public:
+                            TransmitThread(A2dpAudioStreamOut *output)
+                                : Thread(false), mOutput(output) {}
+        private:
+            virtual bool        threadLoop();
+            A2dpAudioStreamOut *mOutput;
+        };
+
+        // audio buffered by the sink after it has been transmitted
+        static const uint32_t kSinkLatencyMs = 200;
+
+        // default and maximum number of bufferSize() buffers held by the ring
+        static const int kDefaultAsyncBufferCount = 4;
+        static const int kMaxAsyncBufferCount = 16;
+
         friend class A2dpAudioInterface;
                 status_t    init();
                 status_t    close();
@@ -105,6 +127,16 @@ private:
                 status_t    setBluetoothEnabled(bool enabled);
                 status_t    setSuspended(bool onOff);
                 status_t    standby_l();
+                status_t    transmit_l(const void* buffer, size_t bytes);
+                status_t    transmit(const void* buffer, size_t bytes);
+                void        queue(const void* buffer, size_t bytes);
+                size_t      ringSize() const { return mRing != NULL ? mRing->size() : 0; }
+                void        stopTransmitThread();
+                void        updateTransmitted(size_t sentBytes, size_t droppedBytes);
+                uint32_t    sinkQueuedFrames_l(nsecs_t now) const;
+                nsecs_t     pacingDeadline_l(nsecs_t now);
+                nsecs_t     framesToNs(uint64_t frames) const;
+                void        sleepUntil(nsecs_t deadline);
 
     private:
                 int         mFd;
@@ -118,8 +150,29 @@ private:
                 uint32_t    mDevice;
                 bool        mClosing;
                 bool        mSuspended;
-                nsecs_t     mLastWriteTime;
                 uint32_t    mBufferDurationUs;
+                nsecs_t     mStartTime;         // start of the write schedule
+                uint64_t    mFramesWritten;     // frames written since standby
+                nsecs_t     mErrorPaceTime;     // end of the audio dropped on errors
+                nsecs_t     mDrift;             // total schedule shift after sink stalls
+                uint32_t    mResyncCount;       // number of schedule shifts
+                nsecs_t     mStandbyStartTime;  // time of last entry in standby
+                nsecs_t     mStandbyTime;       // total time in standby before the last entry
+
+                Mutex       mPositionLock;      // protects the transmit counters below
+                uint64_t    mFramesTransmitted; // frames accepted by the sink since standby
+                nsecs_t     mLastTransmitTime;  // time the sink last accepted data
+                uint32_t    mFramesDropped;     // frames not transmitted because of errors
+                uint64_t    mFramesPresented;   // last position returned by getRenderPosition()
+
+                // asynchronous write mode, enabled by property audio.a2dp.async_write:
+                // write() queues into mRing and mTransmitThread encodes and transmits it
+                sp<TransmitThread> mTransmitThread;
+                AudioRingBuffer* mRing;
+                Mutex       mTransmitLock;      // serializes liba2dp calls on mData
+                volatile int32_t mRingActive;   // data was queued since last underrun or standby
+                uint32_t    mUnderruns;         // ring found empty after queued audio played
+                uint32_t    mOverruns;          // write() found the ring full and dropped data
     };
 
     friend class A2dpAudioStreamOut;
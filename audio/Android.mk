@@ -1,6 +1,7 @@
 # Copyright 2011 The Android Open Source Project
 
 #AUDIO_POLICY_TEST := true
+#AUDIO_POLICY_REPLAY := true
 #ENABLE_AUDIO_DUMP := true
 
 LOCAL_PATH := $(call my-dir)
@@ -8,6 +9,7 @@ include $(CLEAR_VARS)
 
 LOCAL_SRC_FILES := \
     AudioHardwareInterface.cpp \
+    audio_device_conv.cpp \
     audio_hw_hal.cpp
 
 LOCAL_MODULE := libaudiohw_legacy
@@ -57,6 +59,56 @@ LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
 
+# Offline policy benchmark replaying a trace of policy calls against a stub client.
+# Built for the target: libmedia_helper (AudioParameter) only has a target variant and the
+# policy headers include frameworks/av media headers, so there is no host build. The tool
+# does not need the audio HAL or the audio services and runs on any device or emulator.
+ifeq ($(AUDIO_POLICY_REPLAY),true)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    audio_policy_replay.cpp
+
+LOCAL_SHARED_LIBRARIES := \
+    libcutils \
+    libutils \
+    liblog
+
+LOCAL_STATIC_LIBRARIES := \
+    libaudiopolicy_legacy \
+    libmedia_helper
+
+LOCAL_MODULE := audio_policy_replay
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+endif
+
+# Checks the device mask conversion of audio_hw_hal.cpp against the per-bit table lookup
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    audio_device_conv.cpp \
+    tests/audio_device_conv_test.cpp
+
+LOCAL_MODULE := audio_device_conv_test
+LOCAL_MODULE_TAGS := tests
+
+include $(BUILD_NATIVE_TEST)
+
+# Host tool converting the captures written by AudioDumpInterface to WAV files
+ifeq ($(ENABLE_AUDIO_DUMP),true)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    audio_dump_reader.cpp
+
+LOCAL_MODULE := audio_dump_reader
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
+
 #ifeq ($(ENABLE_AUDIO_DUMP),true)
 #  LOCAL_SRC_FILES += AudioDumpInterface.cpp
 #  LOCAL_CFLAGS += -DENABLE_AUDIO_DUMP
@@ -79,3 +131,4 @@ include $(BUILD_SHARED_LIBRARY)
 
 #    AudioHardwareGeneric.cpp \
 #    AudioHardwareStub.cpp \
+#    AudioRingBuffer.cpp \
@@ -24,6 +24,9 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 
 #include "AudioDumpInterface.h"
 
@@ -31,6 +34,466 @@ namespace android {
 
 // ----------------------------------------------------------------------------
 
+AudioDumpWriter::AudioDumpWriter()
+    : Thread(false), mPool(NULL), mNextId(0), mDroppedBuffers(0), mWriteErrors(0),
+      mBytesWritten(0), mPcmBytesWritten(0), mQueuedBlocks(0), mMaxQueuedBlocks(0),
+      mEncodeBuffer(NULL)
+{
+    void *pool;
+    if (posix_memalign(&pool, kBlockAlign, kBlockSize * kBlockCount) != 0) {
+        ALOGE("AudioDumpWriter cannot allocate buffer pool");
+        return;
+    }
+    mPool = (uint8_t *)pool;
+    for (size_t i = 0; i < kBlockCount; i++) {
+        mBlocks[i].mData = mPool + i * kBlockSize;
+        mBlocks[i].mSize = 0;
+        mFreeBlocks.add(i);
+    }
+    // delta encoding takes at most 3 bytes per 16 bit sample
+    mEncodeBuffer = new uint8_t[kBlockSize / sizeof(int16_t) * 3];
+}
+
+AudioDumpWriter::~AudioDumpWriter()
+{
+    for (size_t i = 0; i < mFiles.size(); i++) {
+        File *file = mFiles.valueAt(i);
+        closeSegment(file);
+        free(file->mStage);
+        delete file;
+    }
+    delete[] mEncodeBuffer;
+    free(mPool);
+}
+
+int AudioDumpWriter::open(const char *path, uint32_t sampleRate, uint32_t channels,
+                          int format, size_t frameSize)
+{
+    Mutex::Autolock _l(mLock);
+    int id = mNextId++;
+
+    Capture capture;
+    capture.mBlock = -1;
+    capture.mBytes = 0;
+    capture.mLostBytes = 0;
+    capture.mFrameSize = frameSize != 0 ? frameSize : 1;
+    mCaptures.add(id, capture);
+
+    Request request;
+    request.mType = REQUEST_OPEN;
+    request.mId = id;
+    request.mBlock = -1;
+    request.mPath = path;
+    memset(&request.mHeader, 0, sizeof(request.mHeader));
+    request.mHeader.magic = AUDIO_DUMP_MAGIC;
+    request.mHeader.version = AUDIO_DUMP_VERSION;
+    request.mHeader.headerSize = sizeof(request.mHeader);
+    request.mHeader.sampleRate = sampleRate;
+    request.mHeader.channels = channels;
+    request.mHeader.format = format;
+    request.mHeader.frameSize = capture.mFrameSize;
+    request.mOptions = mOptions;
+    mRequests.add(request);
+    mCond.signal();
+    return id;
+}
+
+void AudioDumpWriter::write(int id, const void *buffer, size_t bytes)
+{
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mCaptures.indexOfKey(id);
+    if (index < 0) {
+        return;
+    }
+    Capture& capture = mCaptures.editValueAt(index);
+    // blocks hold whole frames so that each record starts on a frame
+    size_t blockSize = kBlockSize - kBlockSize % capture.mFrameSize;
+    const uint8_t *src = (const uint8_t *)buffer;
+
+    while (bytes > 0) {
+        if (capture.mBlock < 0) {
+            if (mFreeBlocks.isEmpty()) {
+                // the disk does not keep up: the loss is recorded with the next block
+                mDroppedBuffers++;
+                capture.mLostBytes += bytes;
+                capture.mBytes += bytes;
+                return;
+            }
+            capture.mBlock = mFreeBlocks.top();
+            mFreeBlocks.pop();
+            Block& block = mBlocks[capture.mBlock];
+            block.mSize = 0;
+            block.mPosition = capture.mBytes / capture.mFrameSize;
+            block.mTimestamp = systemTime();
+            block.mLostBytes = capture.mLostBytes;
+            capture.mLostBytes = 0;
+        }
+        Block& block = mBlocks[capture.mBlock];
+        size_t count = blockSize - block.mSize;
+        if (count > bytes) {
+            count = bytes;
+        }
+        memcpy(block.mData + block.mSize, src, count);
+        block.mSize += count;
+        capture.mBytes += count;
+        src += count;
+        bytes -= count;
+        if (block.mSize == blockSize) {
+            queue_l(REQUEST_WRITE, id, capture.mBlock);
+            capture.mBlock = -1;
+        }
+    }
+}
+
+void AudioDumpWriter::close(int id)
+{
+    Mutex::Autolock _l(mLock);
+    ssize_t index = mCaptures.indexOfKey(id);
+    if (index < 0) {
+        return;
+    }
+    const Capture& capture = mCaptures.valueAt(index);
+    if (capture.mBlock >= 0) {
+        queue_l(REQUEST_WRITE, id, capture.mBlock);
+    }
+    Request request;
+    request.mType = REQUEST_CLOSE;
+    request.mId = id;
+    request.mBlock = -1;
+    request.mPosition = capture.mBytes / capture.mFrameSize;
+    request.mTimestamp = systemTime();
+    request.mLostBytes = capture.mLostBytes;
+    mCaptures.removeItemsAt(index);
+    mRequests.add(request);
+    mCond.signal();
+}
+
+// Processes the requests still queued before exiting.
+void AudioDumpWriter::stop()
+{
+    requestExit();
+    {
+        Mutex::Autolock _l(mLock);
+        mCond.broadcast();
+    }
+    requestExitAndWait();
+}
+
+void AudioDumpWriter::dump(String8& result)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+
+    Mutex::Autolock _l(mLock);
+    snprintf(buffer, SIZE, "\tcapture writer: %d/%d blocks free, max queued %d, "
+            "written %llu bytes for %llu PCM bytes\n", (int)mFreeBlocks.size(), (int)kBlockCount,
+            (int)mMaxQueuedBlocks, (unsigned long long)mBytesWritten,
+            (unsigned long long)mPcmBytesWritten);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tdropped buffers %u, write errors %u\n",
+            mDroppedBuffers, mWriteErrors);
+    result.append(buffer);
+    snprintf(buffer, SIZE, "\tmax file size %u, max duration %u ms, max files %u, compress %d\n",
+            mOptions.mMaxFileSize, mOptions.mMaxDurationMs, mOptions.mMaxFiles,
+            mOptions.mCompress);
+    result.append(buffer);
+}
+
+AudioDumpWriter::Options AudioDumpWriter::options()
+{
+    Mutex::Autolock _l(mLock);
+    return mOptions;
+}
+
+void AudioDumpWriter::setOptions(const Options& options)
+{
+    Mutex::Autolock _l(mLock);
+    mOptions = options;
+}
+
+void AudioDumpWriter::queue_l(int type, int id, int block)
+{
+    Request request;
+    request.mType = type;
+    request.mId = id;
+    request.mBlock = block;
+    mRequests.add(request);
+    if (block >= 0) {
+        mQueuedBlocks++;
+        if (mQueuedBlocks > mMaxQueuedBlocks) {
+            mMaxQueuedBlocks = mQueuedBlocks;
+        }
+    }
+    mCond.signal();
+}
+
+bool AudioDumpWriter::threadLoop()
+{
+    // requests still queued when exit is requested are processed so that no captured
+    // data is lost
+    for (;;) {
+        Request request;
+        {
+            Mutex::Autolock _l(mLock);
+            while (mRequests.isEmpty()) {
+                if (exitPending()) {
+                    return false;
+                }
+                mCond.wait(mLock);
+            }
+            request = mRequests[0];
+            mRequests.removeAt(0);
+        }
+        processRequest(request);
+    }
+}
+
+void AudioDumpWriter::processRequest(const Request& request)
+{
+    switch (request.mType) {
+    case REQUEST_OPEN: {
+        File *file = new File;
+        file->mFd = -1;
+        file->mPath = request.mPath;
+        file->mHeader = request.mHeader;
+        file->mOptions = request.mOptions;
+        file->mStageSize = 0;
+        file->mSize = 0;
+        file->mStartTime = 0;
+        void *stage;
+        if (posix_memalign(&stage, kBlockAlign, kStageSize) != 0) {
+            ALOGE("cannot allocate stage buffer for %s", request.mPath.string());
+            stage = NULL;
+        }
+        file->mStage = (uint8_t *)stage;
+        openSegment(file);
+        mFiles.add(request.mId, file);
+        } break;
+
+    case REQUEST_WRITE: {
+        ssize_t index = mFiles.indexOfKey(request.mId);
+        if (index >= 0) {
+            writeRecords(mFiles.valueAt(index), mBlocks[request.mBlock]);
+        }
+        Mutex::Autolock _l(mLock);
+        mPcmBytesWritten += mBlocks[request.mBlock].mSize;
+        mFreeBlocks.add(request.mBlock);
+        mQueuedBlocks--;
+        } break;
+
+    case REQUEST_CLOSE: {
+        ssize_t index = mFiles.indexOfKey(request.mId);
+        if (index >= 0) {
+            File *file = mFiles.valueAt(index);
+            if (request.mLostBytes != 0 && file->mFd >= 0 && file->mStage != NULL) {
+                appendRecord(file, AUDIO_DUMP_RECORD_XRUN, NULL, 0, request.mLostBytes,
+                        request.mPosition - request.mLostBytes / file->mHeader.frameSize,
+                        request.mTimestamp);
+            }
+            closeSegment(file);
+            free(file->mStage);
+            delete file;
+            mFiles.removeItemsAt(index);
+        }
+        } break;
+    }
+}
+
+void AudioDumpWriter::writeRecords(File *file, const Block& block)
+{
+    if (file->mFd < 0 || file->mStage == NULL) {
+        return;
+    }
+    const Options& options = file->mOptions;
+    if (file->mStartTime == 0) {
+        file->mStartTime = block.mTimestamp;
+    } else if ((options.mMaxFileSize != 0 && file->mSize >= options.mMaxFileSize) ||
+            (options.mMaxDurationMs != 0 &&
+                    block.mTimestamp - file->mStartTime >= ms2ns(options.mMaxDurationMs))) {
+        closeSegment(file);
+        file->mHeader.segment++;
+        openSegment(file);
+        if (file->mFd < 0) {
+            return;
+        }
+        file->mStartTime = block.mTimestamp;
+    }
+
+    if (block.mLostBytes != 0) {
+        appendRecord(file, AUDIO_DUMP_RECORD_XRUN, NULL, 0, block.mLostBytes,
+                block.mPosition - block.mLostBytes / file->mHeader.frameSize, block.mTimestamp);
+    }
+
+    uint32_t type = AUDIO_DUMP_RECORD_PCM;
+    const void *payload = block.mData;
+    size_t size = block.mSize;
+    uint32_t channelCount = file->mHeader.frameSize / sizeof(int16_t);
+    if (options.mCompress && file->mHeader.format == AudioSystem::PCM_16_BIT &&
+            channelCount != 0 && channelCount <= kMaxDeltaChannels && mEncodeBuffer != NULL) {
+        size_t encoded = encodeDelta((const int16_t *)block.mData,
+                block.mSize / sizeof(int16_t), channelCount, mEncodeBuffer);
+        // keep raw PCM when it is not smaller, e.g. for noise
+        if (encoded < block.mSize) {
+            type = AUDIO_DUMP_RECORD_PCM_DELTA;
+            payload = mEncodeBuffer;
+            size = encoded;
+        }
+    }
+    appendRecord(file, type, payload, size, block.mSize, block.mPosition, block.mTimestamp);
+}
+
+void AudioDumpWriter::appendRecord(File *file, uint32_t type, const void *payload, size_t size,
+                                   uint32_t pcmSize, int64_t position, nsecs_t timestamp)
+{
+    struct audio_dump_record record;
+    record.type = type;
+    record.size = size;
+    record.pcmSize = pcmSize;
+    record.reserved = 0;
+    record.position = position;
+    record.timestamp = timestamp;
+
+    memcpy(file->mStage + file->mStageSize, &record, sizeof(record));
+    file->mStageSize += sizeof(record);
+    if (size != 0) {
+        memcpy(file->mStage + file->mStageSize, payload, size);
+        file->mStageSize += size;
+    }
+    file->mSize += sizeof(record) + size;
+    if (file->mStageSize >= kBlockSize) {
+        flushStage(file, false);
+    }
+}
+
+// Creates the file for the current segment and stages its header. Deletes the oldest
+// segment if more than mMaxFiles would be kept.
+void AudioDumpWriter::openSegment(File *file)
+{
+    char name[256];
+    uint32_t segment = file->mHeader.segment;
+
+    snprintf(name, sizeof(name), "%s.%03u" AUDIO_DUMP_FILE_SUFFIX, file->mPath.string(), segment);
+#ifdef O_DIRECT
+    file->mFd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+#endif
+    if (file->mFd < 0) {
+        file->mFd = ::open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    ALOGV("Opening dump file %s, fd %d", name, file->mFd);
+    if (file->mFd < 0) {
+        ALOGW("cannot open dump file %s: %s", name, strerror(errno));
+        return;
+    }
+    if (file->mOptions.mMaxFiles != 0 && segment >= file->mOptions.mMaxFiles) {
+        snprintf(name, sizeof(name), "%s.%03u" AUDIO_DUMP_FILE_SUFFIX, file->mPath.string(),
+                segment - file->mOptions.mMaxFiles);
+        unlink(name);
+    }
+
+    file->mHeader.realtime = systemTime(SYSTEM_TIME_REALTIME);
+    file->mHeader.monotonic = systemTime(SYSTEM_TIME_MONOTONIC);
+    file->mSize = sizeof(file->mHeader);
+    if (file->mStage != NULL) {
+        memcpy(file->mStage, &file->mHeader, sizeof(file->mHeader));
+        file->mStageSize = sizeof(file->mHeader);
+    }
+}
+
+void AudioDumpWriter::closeSegment(File *file)
+{
+    if (file->mFd < 0) {
+        return;
+    }
+    if (file->mStage != NULL) {
+        flushStage(file, true);
+    }
+    ::close(file->mFd);
+    file->mFd = -1;
+}
+
+// Writes the staged records in multiples of kBlockAlign, or all of them when the segment
+// is closed.
+void AudioDumpWriter::flushStage(File *file, bool all)
+{
+    size_t size = all ? file->mStageSize : file->mStageSize & ~(kBlockAlign - 1);
+    if (size == 0) {
+        return;
+    }
+    writeAligned(file->mFd, file->mStage, size);
+    file->mStageSize -= size;
+    memmove(file->mStage, file->mStage + size, file->mStageSize);
+}
+
+// Only the end of a segment is not a multiple of the O_DIRECT alignment: this tail is
+// written through the page cache.
+ssize_t AudioDumpWriter::writeAligned(int fd, const uint8_t *data, size_t size)
+{
+    size_t direct = size & ~(kBlockAlign - 1);
+    ssize_t written = 0;
+    ssize_t ret = 0;
+
+    if (direct != 0) {
+        ret = ::write(fd, data, direct);
+#ifdef O_DIRECT
+        if (ret < 0 && errno == EINVAL) {
+            // the file system accepted O_DIRECT on open but not on write
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+            ret = ::write(fd, data, direct);
+        }
+#endif
+        if (ret > 0) {
+            written += ret;
+        }
+    }
+    if (ret >= 0 && size > direct) {
+#ifdef O_DIRECT
+        int flags = fcntl(fd, F_GETFL);
+        if (flags & O_DIRECT) {
+            fcntl(fd, F_SETFL, flags & ~O_DIRECT);
+        }
+#endif
+        ret = ::write(fd, data + direct, size - direct);
+        if (ret > 0) {
+            written += ret;
+        }
+    }
+
+    Mutex::Autolock _l(mLock);
+    if (ret < 0) {
+        mWriteErrors++;
+    }
+    mBytesWritten += written;
+    return ret < 0 ? ret : written;
+}
+
+// Lossless encoding of interleaved 16 bit samples described in audio_dump_format.h.
+// Returns the number of bytes written to out.
+size_t AudioDumpWriter::encodeDelta(const int16_t *samples, size_t count, uint32_t channelCount,
+                                    uint8_t *out)
+{
+    int32_t previous[kMaxDeltaChannels];
+    uint8_t *p = out;
+    uint32_t channel = 0;
+
+    memset(previous, 0, sizeof(previous));
+    for (size_t i = 0; i < count; i++) {
+        int32_t delta = samples[i] - previous[channel];
+        previous[channel] = samples[i];
+        uint32_t value = ((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31);
+        while (value >= 0x80) {
+            *p++ = (value & 0x7f) | 0x80;
+            value >>= 7;
+        }
+        *p++ = value;
+        if (++channel == channelCount) {
+            channel = 0;
+        }
+    }
+    return p - out;
+}
+
+// ----------------------------------------------------------------------------
+
 AudioDumpInterface::AudioDumpInterface(AudioHardwareInterface* hw)
     : mPolicyCommands(String8("")), mFileName(String8(""))
 {
@@ -38,6 +501,8 @@ AudioDumpInterface::AudioDumpInterface(AudioHardwareInterface* hw)
         ALOGE("Dump construct hw = 0");
     }
     mFinalInterface = hw;
+    mWriter = new AudioDumpWriter();
+    mWriter->run("AudioDumpWriter");
     ALOGV("Constructor %p, mFinalInterface %p", this, mFinalInterface);
 }
 
@@ -52,6 +517,7 @@ AudioDumpInterface::~AudioDumpInterface()
         closeInputStream((AudioStreamIn *)mInputs[i]);
     }
 
+    mWriter->stop();
     if(mFinalInterface) delete mFinalInterface;
 }
 
@@ -197,6 +663,35 @@ status_t AudioDumpInterface::setParameters(const String8& keyValuePairs)
         mFileName = value;
         param.remove(String8("test_cmd_file_name"));
     }
+    // capture options apply to the files opened afterwards
+    AudioDumpWriter::Options options = mWriter->options();
+    bool optionsChanged = false;
+    if (param.getInt(String8("test_cmd_dump_max_size"), valueInt) == NO_ERROR) {
+        options.mMaxFileSize = valueInt > 0 ? valueInt : 0;
+        param.remove(String8("test_cmd_dump_max_size"));
+        optionsChanged = true;
+    }
+    if (param.getInt(String8("test_cmd_dump_max_duration_ms"), valueInt) == NO_ERROR) {
+        options.mMaxDurationMs = valueInt > 0 ? valueInt : 0;
+        param.remove(String8("test_cmd_dump_max_duration_ms"));
+        optionsChanged = true;
+    }
+    if (param.getInt(String8("test_cmd_dump_max_files"), valueInt) == NO_ERROR) {
+        options.mMaxFiles = valueInt > 0 ? valueInt : 0;
+        param.remove(String8("test_cmd_dump_max_files"));
+        optionsChanged = true;
+    }
+    if (param.getInt(String8("test_cmd_dump_compress"), valueInt) == NO_ERROR) {
+        options.mCompress = valueInt != 0;
+        param.remove(String8("test_cmd_dump_compress"));
+        optionsChanged = true;
+    }
+    if (optionsChanged) {
+        mWriter->setOptions(options);
+        ALOGV("dump options: max size %u, max duration %u ms, max files %u, compress %d",
+                options.mMaxFileSize, options.mMaxDurationMs, options.mMaxFiles,
+                options.mCompress);
+    }
     if (param.get(String8("test_cmd_policy"), value) == NO_ERROR) {
         Mutex::Autolock _l(mLock);
         param.remove(String8("test_cmd_policy"));
@@ -253,6 +748,14 @@ size_t AudioDumpInterface::getInputBufferSize(uint32_t sampleRate, int format, i
     return mFinalInterface->getInputBufferSize(sampleRate, format, channelCount);
 }
 
+status_t AudioDumpInterface::dump(int fd, const Vector<String16>& args)
+{
+    String8 result("AudioDumpInterface::dump\n");
+    mWriter->dump(result);
+    ::write(fd, result.string(), result.size());
+    return mFinalInterface->dumpState(fd, args);
+}
+
 // ----------------------------------------------------------------------------
 
 AudioStreamOutDump::AudioStreamOutDump(AudioDumpInterface *interface,
@@ -264,7 +767,7 @@ AudioStreamOutDump::AudioStreamOutDump(AudioDumpInterface *interface,
                                         uint32_t sampleRate)
     : mInterface(interface), mId(id),
       mSampleRate(sampleRate), mFormat(format), mChannels(channels), mLatency(0), mDevice(devices),
-      mBufferSize(1024), mFinalStream(finalStream), mFile(0), mFileCount(0)
+      mBufferSize(1024), mFinalStream(finalStream), mCaptureId(-1), mFileCount(0)
 {
     ALOGV("AudioStreamOutDump Constructor %p, mInterface %p, mFinalStream %p", this, mInterface, mFinalStream);
 }
@@ -286,23 +789,24 @@ ssize_t AudioStreamOutDump::write(const void* buffer, size_t bytes)
         usleep((((bytes * 1000) / frameSize()) / sampleRate()) * 1000);
         ret = bytes;
     }
-    if(!mFile) {
+    if (mCaptureId < 0) {
         if (mInterface->fileName() != "") {
             char name[255];
-            sprintf(name, "%s_out_%d_%d.pcm", mInterface->fileName().string(), mId, ++mFileCount);
-            mFile = fopen(name, "wb");
-            ALOGV("Opening dump file %s, fh %p", name, mFile);
+            sprintf(name, "%s_out_%d_%d", mInterface->fileName().string(), mId, ++mFileCount);
+            mCaptureId = mInterface->writer()->open(name, sampleRate(), channels(), format(),
+                    frameSize());
+            ALOGV("Opening dump file %s, capture %d", name, mCaptureId);
         }
     }
-    if (mFile) {
-        fwrite(buffer, bytes, 1, mFile);
+    if (mCaptureId >= 0) {
+        mInterface->writer()->write(mCaptureId, buffer, bytes);
     }
     return ret;
 }
 
 status_t AudioStreamOutDump::standby()
 {
-    ALOGV("AudioStreamOutDump standby(), mFile %p, mFinalStream %p", mFile, mFinalStream);
+    ALOGV("AudioStreamOutDump standby(), mCaptureId %d, mFinalStream %p", mCaptureId, mFinalStream);
 
     Close();
     if (mFinalStream != 0 ) return mFinalStream->standby();
@@ -359,7 +863,7 @@ status_t AudioStreamOutDump::setParameters(const String8& keyValuePairs)
     }
 
     if (param.getInt(String8("format"), valueInt) == NO_ERROR) {
-        if (mFile == 0) {
+        if (mCaptureId < 0) {
             mFormat = valueInt;
         } else {
             status = INVALID_OPERATION;
@@ -374,7 +878,7 @@ status_t AudioStreamOutDump::setParameters(const String8& keyValuePairs)
     }
     if (param.getInt(String8("sampling_rate"), valueInt) == NO_ERROR) {
         if (valueInt > 0 && valueInt <= 48000) {
-            if (mFile == 0) {
+            if (mCaptureId < 0) {
                 mSampleRate = valueInt;
             } else {
                 status = INVALID_OPERATION;
@@ -402,9 +906,9 @@ status_t AudioStreamOutDump::dump(int fd, const Vector<String16>& args)
 
 void AudioStreamOutDump::Close()
 {
-    if(mFile) {
-        fclose(mFile);
-        mFile = 0;
+    if (mCaptureId >= 0) {
+        mInterface->writer()->close(mCaptureId);
+        mCaptureId = -1;
     }
 }
 
@@ -425,7 +929,7 @@ AudioStreamInDump::AudioStreamInDump(AudioDumpInterface *interface,
                                         uint32_t sampleRate)
     : mInterface(interface), mId(id),
       mSampleRate(sampleRate), mFormat(format), mChannels(channels), mDevice(devices),
-      mBufferSize(1024), mFinalStream(finalStream), mFile(0), mFileCount(0)
+      mBufferSize(1024), mFinalStream(finalStream), mFile(0), mCaptureId(-1), mFileCount(0)
 {
     ALOGV("AudioStreamInDump Constructor %p, mInterface %p, mFinalStream %p", this, mInterface, mFinalStream);
 }
@@ -442,16 +946,17 @@ ssize_t AudioStreamInDump::read(void* buffer, ssize_t bytes)
 
     if (mFinalStream) {
         ret = mFinalStream->read(buffer, bytes);
-        if(!mFile) {
+        if (mCaptureId < 0) {
             if (mInterface->fileName() != "") {
                 char name[255];
-                sprintf(name, "%s_in_%d_%d.pcm", mInterface->fileName().string(), mId, ++mFileCount);
-                mFile = fopen(name, "wb");
-                ALOGV("Opening input dump file %s, fh %p", name, mFile);
+                sprintf(name, "%s_in_%d_%d", mInterface->fileName().string(), mId, ++mFileCount);
+                mCaptureId = mInterface->writer()->open(name, sampleRate(), channels(), format(),
+                        frameSize());
+                ALOGV("Opening input dump file %s, capture %d", name, mCaptureId);
             }
         }
-        if (mFile) {
-            fwrite(buffer, bytes, 1, mFile);
+        if (mCaptureId >= 0) {
+            mInterface->writer()->write(mCaptureId, buffer, bytes);
         }
     } else {
         usleep((((bytes * 1000) / frameSize()) / sampleRate()) * 1000);
@@ -569,5 +1074,9 @@ void AudioStreamInDump::Close()
         fclose(mFile);
         mFile = 0;
     }
+    if (mCaptureId >= 0) {
+        mInterface->writer()->close(mCaptureId);
+        mCaptureId = -1;
+    }
 }
 }; // namespace android
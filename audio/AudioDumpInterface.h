@@ -22,15 +22,142 @@
 #include <sys/types.h>
 #include <utils/String8.h>
 #include <utils/SortedVector.h>
+#include <utils/KeyedVector.h>
+#include <utils/threads.h>
 
 #include <hardware_legacy/AudioHardwareBase.h>
 
+#include "audio_dump_format.h"
+
 namespace android {
 
 #define AUDIO_DUMP_WAVE_HDR_SIZE 44
 
 class AudioDumpInterface;
 
+// Writes captured audio to files from a background thread so that the audio threads never
+// wait on the disk. Captured data is copied into blocks from a pool allocated up front and
+// full blocks are written with large aligned writes, using O_DIRECT when the file system
+// supports it. When the disk falls behind and no block is free, the data is dropped and
+// an xrun record is written. Files use the format described in audio_dump_format.h.
+class AudioDumpWriter : public Thread {
+public:
+    class Options {
+    public:
+                Options() : mMaxFileSize(0), mMaxDurationMs(0), mMaxFiles(0), mCompress(false) {}
+        uint32_t mMaxFileSize;      // bytes per segment file, 0 for no limit
+        uint32_t mMaxDurationMs;    // duration of a segment file, 0 for no limit
+        uint32_t mMaxFiles;         // segment files kept per capture, 0 to keep all
+        bool    mCompress;          // delta encode 16 bit PCM
+    };
+
+                        AudioDumpWriter();
+    virtual             ~AudioDumpWriter();
+
+    // returns a capture id; the files "<path>.<segment>.adump" are created by the writer
+    // thread. Options are applied to captures opened afterwards.
+            int         open(const char *path, uint32_t sampleRate, uint32_t channels,
+                                int format, size_t frameSize);
+            void        write(int id, const void *buffer, size_t bytes);
+            // queues the data not written yet, then closes the file
+            void        close(int id);
+            void        stop();
+            void        dump(String8& result);
+            Options     options();
+            void        setOptions(const Options& options);
+
+private:
+    static const size_t kBlockSize = 64 * 1024;
+    static const size_t kBlockCount = 16;
+    static const size_t kBlockAlign = 4096;
+    // a record is flushed as soon as kBlockSize bytes are staged: room for one more
+    // record of a block encoded at worst 3 bytes per 16 bit sample
+    static const size_t kStageSize = 3 * kBlockSize;
+    static const uint32_t kMaxDeltaChannels = 8;
+
+    enum {
+        REQUEST_OPEN,
+        REQUEST_WRITE,
+        REQUEST_CLOSE
+    };
+
+    class Request {
+    public:
+        int     mType;
+        int     mId;
+        int     mBlock;     // REQUEST_WRITE: index of the block to write
+        String8 mPath;      // REQUEST_OPEN: capture file name without segment suffix
+        struct audio_dump_header mHeader;   // REQUEST_OPEN: stream configuration
+        Options mOptions;   // REQUEST_OPEN
+        int64_t mPosition;  // REQUEST_CLOSE: frames received, including those dropped
+        nsecs_t mTimestamp; // REQUEST_CLOSE
+        uint32_t mLostBytes; // REQUEST_CLOSE: bytes dropped after the last block
+    };
+
+    class Block {
+    public:
+        uint8_t *mData;
+        size_t  mSize;
+        int64_t mPosition;      // frames since the capture started
+        nsecs_t mTimestamp;     // time the first frame was received
+        uint32_t mLostBytes;    // bytes dropped just before this block
+    };
+
+    // producer side state of a capture
+    class Capture {
+    public:
+        int     mBlock;         // block being filled, -1 if none
+        uint64_t mBytes;        // bytes received, including those dropped
+        uint32_t mLostBytes;    // bytes dropped since the last block was started
+        size_t  mFrameSize;
+    };
+
+    // writer thread state of a capture
+    class File {
+    public:
+        int     mFd;
+        String8 mPath;
+        struct audio_dump_header mHeader;
+        Options mOptions;
+        uint8_t *mStage;        // records waiting for an aligned write
+        size_t  mStageSize;
+        uint64_t mSize;         // bytes in the current segment
+        nsecs_t mStartTime;     // timestamp of the first record of the current segment
+    };
+
+    virtual bool        threadLoop();
+            void        queue_l(int type, int id, int block);
+            void        processRequest(const Request& request);
+            void        writeRecords(File *file, const Block& block);
+            void        appendRecord(File *file, uint32_t type, const void *payload, size_t size,
+                                     uint32_t pcmSize, int64_t position, nsecs_t timestamp);
+            void        openSegment(File *file);
+            void        closeSegment(File *file);
+            void        flushStage(File *file, bool all);
+            ssize_t     writeAligned(int fd, const uint8_t *data, size_t size);
+    static  size_t      encodeDelta(const int16_t *samples, size_t count, uint32_t channelCount,
+                                    uint8_t *out);
+
+    Mutex               mLock;
+    Condition           mCond;
+    uint8_t             *mPool;
+    Block               mBlocks[kBlockCount];
+    Vector<int>         mFreeBlocks;
+    Vector<Request>     mRequests;
+    KeyedVector<int, Capture> mCaptures;
+    Options             mOptions;
+    int                 mNextId;
+    uint32_t            mDroppedBuffers;
+    uint32_t            mWriteErrors;
+    uint64_t            mBytesWritten;
+    uint64_t            mPcmBytesWritten;
+    size_t              mQueuedBlocks;
+    size_t              mMaxQueuedBlocks;
+    // only used by the writer thread
+    KeyedVector<int, File *> mFiles;
+    uint8_t             *mEncodeBuffer;
+};
+
 class AudioStreamOutDump : public AudioStreamOut {
 public:
                         AudioStreamOutDump(AudioDumpInterface *interface,
@@ -69,7 +196,7 @@ private:
     uint32_t mDevice;                   // current device this output is routed to
     size_t  mBufferSize;
     AudioStreamOut      *mFinalStream;
-    FILE                *mFile;      // output file
+    int                 mCaptureId;     // AudioDumpWriter capture id, -1 if not capturing
     int                 mFileCount;
 };
 
@@ -109,7 +236,8 @@ private:
     uint32_t mDevice;                   // current device this output is routed to
     size_t  mBufferSize;
     AudioStreamIn      *mFinalStream;
-    FILE                *mFile;      // output file
+    FILE                *mFile;      // input file read when there is no final stream
+    int                 mCaptureId;     // AudioDumpWriter capture id, -1 if not capturing
     int                 mFileCount;
 };
 
@@ -152,9 +280,10 @@ public:
             uint32_t *sampleRate, status_t *status, AudioSystem::audio_in_acoustics acoustics);
     virtual    void        closeInputStream(AudioStreamIn* in);
 
-    virtual status_t    dump(int fd, const Vector<String16>& args) { return mFinalInterface->dumpState(fd, args); }
+    virtual status_t    dump(int fd, const Vector<String16>& args);
 
             String8     fileName() const { return mFileName; }
+            AudioDumpWriter* writer() const { return mWriter.get(); }
 protected:
 
     AudioHardwareInterface          *mFinalInterface;
@@ -163,6 +292,7 @@ protected:
     Mutex                           mLock;
     String8                         mPolicyCommands;
     String8                         mFileName;
+    sp<AudioDumpWriter>             mWriter;
 };
 
 }; // namespace android
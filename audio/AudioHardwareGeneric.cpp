@@ -22,12 +22,17 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sched.h>
+#include <pthread.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/ioctl.h>
 
 #define LOG_TAG "AudioHardware"
 #include <utils/Log.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
 
 #include "AudioHardwareGeneric.h"
 #include <media/AudioRecord.h>
@@ -40,6 +45,12 @@ namespace android_audio_legacy {
 
 static char const * const kAudioDeviceName = "/dev/eac";
 
+// SCHED_FIFO priority of the asynchronous output writer thread
+static const int kAsyncWriterPriority = 2;
+
+// maximum time to wait for the ring to drain on standby
+static const int kRingDrainTimeoutMs = 500;
+
 // ----------------------------------------------------------------------------
 
 AudioHardwareGeneric::AudioHardwareGeneric()
@@ -223,21 +234,150 @@ status_t AudioStreamOutGeneric::set(
     mAudioHardware = hw;
     mFd = fd;
     mDevice = devices;
+
+    if (AudioRingBuffer::isEnabled("audio.generic.async_write") && mAsyncWriter == 0) {
+        mRing = new AudioRingBuffer(bufferSize() * kAsyncBufferCount);
+        mAsyncWriter = new AsyncWriter(this);
+        if (mAsyncWriter->run("AudioOutGenericWriter") != NO_ERROR) {
+            ALOGW("set() cannot start writer thread, using synchronous writes");
+            mAsyncWriter.clear();
+            delete mRing;
+            mRing = 0;
+        }
+    }
     return NO_ERROR;
 }
 
+AudioStreamOutGeneric::AudioStreamOutGeneric()
+    : mAudioHardware(0), mFd(-1), mDevice(0), mFramesWritten(0), mLastWriteTime(0),
+      mFramesPresented(0),
+      mRing(0), mRingActive(0), mUnderruns(0), mWriteStalls(0)
+{
+}
+
 AudioStreamOutGeneric::~AudioStreamOutGeneric()
 {
+    stopAsyncWriter();
+    delete mRing;
 }
 
 ssize_t AudioStreamOutGeneric::write(const void* buffer, size_t bytes)
 {
+    if (mAsyncWriter != 0) {
+        return writeAsync(buffer, bytes);
+    }
     Mutex::Autolock _l(mLock);
-    return ssize_t(::write(mFd, buffer, bytes));
+    ssize_t written = ::write(mFd, buffer, bytes);
+    if (written > 0) {
+        updatePosition(written);
+    }
+    return written;
+}
+
+void AudioStreamOutGeneric::updatePosition(size_t bytes)
+{
+    Mutex::Autolock _l(mPositionLock);
+    mFramesWritten += bytes / frameSize();
+    mLastWriteTime = systemTime(SYSTEM_TIME_MONOTONIC);
+}
+
+// The driver does not report its read position: assume it holds latency() worth of audio
+// when a write returns and plays it out in real time until the next write.
+uint32_t AudioStreamOutGeneric::driverQueuedFrames_l(nsecs_t now) const
+{
+    uint32_t queued = latency() * sampleRate() / 1000;
+    uint64_t played = (uint64_t)(now - mLastWriteTime) * sampleRate() / 1000000000LL;
+    if (played >= queued) {
+        return 0;
+    }
+    queued -= (uint32_t)played;
+    return queued < mFramesWritten ? queued : mFramesWritten;
+}
+
+// Copies into the ring and returns without touching the driver. Only waits when the ring
+// is full, i.e. when the driver is more than kAsyncBufferCount buffers behind.
+ssize_t AudioStreamOutGeneric::writeAsync(const void* buffer, size_t bytes)
+{
+    const uint8_t *src = (const uint8_t *)buffer;
+    size_t remaining = bytes;
+
+    while (remaining > 0) {
+        size_t count = mRing->write(src, remaining);
+        if (count == 0) {
+            mWriteStalls++;
+            mRing->waitForSpace(0);
+            continue;
+        }
+        src += count;
+        remaining -= count;
+        if (android_atomic_acquire_load(&mRingActive) == 0) {
+            android_atomic_release_store(1, &mRingActive);
+        }
+    }
+    return ssize_t(bytes);
+}
+
+void AudioStreamOutGeneric::stopAsyncWriter()
+{
+    if (mAsyncWriter == 0) {
+        return;
+    }
+    mAsyncWriter->requestExit();
+    mRing->abort();
+    mAsyncWriter->requestExitAndWait();
+    mAsyncWriter.clear();
+}
+
+status_t AudioStreamOutGeneric::AsyncWriter::readyToRun()
+{
+    struct sched_param param;
+    param.sched_priority = kAsyncWriterPriority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+        ALOGW("AsyncWriter cannot set SCHED_FIFO priority %d", kAsyncWriterPriority);
+    }
+    return NO_ERROR;
+}
+
+bool AudioStreamOutGeneric::AsyncWriter::threadLoop()
+{
+    AudioStreamOutGeneric *out = mOutput;
+    const uint8_t *data;
+    size_t count = out->mRing->readBuffer(&data, out->bufferSize());
+
+    if (count == 0) {
+        // the mixer did not keep up: the driver is fed nothing until the next write()
+        if (android_atomic_release_cas(1, 0, &out->mRingActive) == 0) {
+            out->mUnderruns++;
+        }
+        return out->mRing->waitForData() && !exitPending();
+    }
+
+    ssize_t written = ::write(out->mFd, data, count);
+    if (written < 0) {
+        // drop the data rather than spin on a failing driver
+        ALOGW("AsyncWriter write error %d", (int)written);
+        written = count;
+    } else {
+        out->updatePosition(written);
+    }
+    out->mRing->advanceRead(written);
+    return true;
 }
 
 status_t AudioStreamOutGeneric::standby()
 {
+    if (mAsyncWriter != 0) {
+        if (!mRing->waitForEmpty(systemTime() + milliseconds(kRingDrainTimeoutMs))) {
+            ALOGW("standby() ring not drained");
+        }
+        // an empty ring in standby is not an underrun
+        android_atomic_release_store(0, &mRingActive);
+    }
+    {
+        Mutex::Autolock _l(mPositionLock);
+        mFramesWritten = 0;
+        mFramesPresented = 0;
+    }
     // Implement: audio hardware to standby mode
     return NO_ERROR;
 }
@@ -263,6 +403,13 @@ status_t AudioStreamOutGeneric::dump(int fd, const Vector<String16>& args)
     result.append(buffer);
     snprintf(buffer, SIZE, "\tmFd: %d\n", mFd);
     result.append(buffer);
+    snprintf(buffer, SIZE, "\tframes written: %u\n", mFramesWritten);
+    result.append(buffer);
+    if (mAsyncWriter != 0) {
+        snprintf(buffer, SIZE, "\tasync ring: %u/%u bytes underruns: %u write stalls: %u\n",
+                (uint32_t)mRing->filled(), (uint32_t)mRing->size(), mUnderruns, mWriteStalls);
+        result.append(buffer);
+    }
     ::write(fd, result.string(), result.size());
     return NO_ERROR;
 }
@@ -302,7 +449,43 @@ String8 AudioStreamOutGeneric::getParameters(const String8& keys)
 
 status_t AudioStreamOutGeneric::getRenderPosition(uint32_t *dspFrames)
 {
-    return INVALID_OPERATION;
+    if (dspFrames == NULL) {
+        return BAD_VALUE;
+    }
+    // frames handed to the driver, not those still queued in the ring, minus those the
+    // driver has not played yet
+    Mutex::Autolock _l(mPositionLock);
+    uint32_t position = mFramesWritten - driverQueuedFrames_l(systemTime(SYSTEM_TIME_MONOTONIC));
+    // the estimate restarts from a full driver queue after each write: never go backwards
+    if ((int32_t)(position - mFramesPresented) > 0) {
+        mFramesPresented = position;
+    }
+    *dspFrames = mFramesPresented;
+    return NO_ERROR;
+}
+
+// Returns the monotonic time in microseconds at which the data passed to the next write()
+// will start playing: after what the driver and the ring still hold.
+status_t AudioStreamOutGeneric::getNextWriteTimestamp(int64_t *timestamp)
+{
+    if (timestamp == NULL) {
+        return BAD_VALUE;
+    }
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    uint32_t queued;
+    {
+        Mutex::Autolock _l(mPositionLock);
+        if (mFramesWritten == 0) {
+            // in standby: start time depends on when the driver restarts
+            return INVALID_OPERATION;
+        }
+        queued = driverQueuedFrames_l(now);
+    }
+    if (mAsyncWriter != 0) {
+        queued += mRing->filled() / frameSize();
+    }
+    *timestamp = ns2us(now) + (int64_t)queued * 1000000 / sampleRate();
+    return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
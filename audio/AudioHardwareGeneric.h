@@ -22,13 +22,19 @@
 #include <sys/types.h>
 
 #include <utils/threads.h>
+#include <utils/Timers.h>
 
 #include <hardware_legacy/AudioSystemLegacy.h>
 #include <hardware_legacy/AudioHardwareBase.h>
 
+#include "AudioRingBuffer.h"
+
 namespace android_audio_legacy {
     using android::Mutex;
     using android::AutoMutex;
+    using android::Condition;
+    using android::Thread;
+    using android::sp;
 
 // ----------------------------------------------------------------------------
 
@@ -36,7 +42,7 @@ class AudioHardwareGeneric;
 
 class AudioStreamOutGeneric : public AudioStreamOut {
 public:
-                        AudioStreamOutGeneric() : mAudioHardware(0), mFd(-1) {}
+                        AudioStreamOutGeneric();
     virtual             ~AudioStreamOutGeneric();
 
     virtual status_t    set(
@@ -59,12 +65,44 @@ public:
     virtual status_t    setParameters(const String8& keyValuePairs);
     virtual String8     getParameters(const String8& keys);
     virtual status_t    getRenderPosition(uint32_t *dspFrames);
+    virtual status_t    getNextWriteTimestamp(int64_t *timestamp);
 
 private:
+    // drains the ring buffer to the driver in asynchronous write mode
+    class AsyncWriter : public Thread {
+    public:
+                        AsyncWriter(AudioStreamOutGeneric *output)
+                            : Thread(false), mOutput(output) {}
+    private:
+        virtual status_t    readyToRun();
+        virtual bool        threadLoop();
+        AudioStreamOutGeneric *mOutput;
+    };
+
+    // number of bufferSize() buffers held by the ring in asynchronous write mode
+    static const size_t kAsyncBufferCount = 4;
+
+    ssize_t             writeAsync(const void* buffer, size_t bytes);
+    void                stopAsyncWriter();
+    void                updatePosition(size_t bytes);
+    uint32_t            driverQueuedFrames_l(nsecs_t now) const;
+
     AudioHardwareGeneric *mAudioHardware;
     Mutex   mLock;
     int     mFd;
     uint32_t mDevice;
+    Mutex   mPositionLock;      // protects mFramesWritten, mLastWriteTime and mFramesPresented
+    uint32_t mFramesWritten;    // frames written to the driver since standby
+    nsecs_t mLastWriteTime;     // monotonic time the last driver write returned
+    uint32_t mFramesPresented;  // last position returned by getRenderPosition()
+
+    // asynchronous write mode, enabled by property audio.generic.async_write: write() queues
+    // into mRing and mAsyncWriter drains it to the driver
+    sp<AsyncWriter> mAsyncWriter;
+    AudioRingBuffer *mRing;
+    volatile int32_t mRingActive;   // data was written since last underrun or standby
+    uint32_t mUnderruns;        // ring found empty by mAsyncWriter while active
+    uint32_t mWriteStalls;      // write() waited for free space in the ring
 };
 
 class AudioStreamInGeneric : public AudioStreamIn {
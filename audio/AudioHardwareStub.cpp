@@ -21,6 +21,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <utils/String8.h>
+#include <utils/Timers.h>
 
 #include "AudioHardwareStub.h"
 #include <media/AudioRecord.h>
@@ -129,11 +130,13 @@ ssize_t AudioStreamOutStub::write(const void* buffer, size_t bytes)
 {
     // fake timing for audio output
     usleep(bytes * 1000000 / sizeof(int16_t) / AudioSystem::popCount(channels()) / sampleRate());
+    mFramesWritten += bytes / frameSize();
     return bytes;
 }
 
 status_t AudioStreamOutStub::standby()
 {
+    mFramesWritten = 0;
     return NO_ERROR;
 }
 
@@ -160,7 +163,22 @@ String8 AudioStreamOutStub::getParameters(const String8& keys)
 
 status_t AudioStreamOutStub::getRenderPosition(uint32_t *dspFrames)
 {
-    return INVALID_OPERATION;
+    if (dspFrames == NULL) {
+        return BAD_VALUE;
+    }
+    // write() returns once its data has been played
+    *dspFrames = mFramesWritten;
+    return NO_ERROR;
+}
+
+status_t AudioStreamOutStub::getNextWriteTimestamp(int64_t *timestamp)
+{
+    if (timestamp == NULL) {
+        return BAD_VALUE;
+    }
+    // nothing is queued: the next write starts playing as soon as it is issued
+    *timestamp = ns2us(systemTime(SYSTEM_TIME_MONOTONIC));
+    return NO_ERROR;
 }
 
 // ----------------------------------------------------------------------------
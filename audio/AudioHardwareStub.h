@@ -29,6 +29,7 @@ namespace android_audio_legacy {
 
 class AudioStreamOutStub : public AudioStreamOut {
 public:
+                        AudioStreamOutStub() : mFramesWritten(0) {}
     virtual status_t    set(int *pFormat, uint32_t *pChannels, uint32_t *pRate);
     virtual uint32_t    sampleRate() const { return 44100; }
     virtual size_t      bufferSize() const { return 4096; }
@@ -42,6 +43,10 @@ public:
     virtual status_t    setParameters(const String8& keyValuePairs) { return NO_ERROR;}
     virtual String8     getParameters(const String8& keys);
     virtual status_t    getRenderPosition(uint32_t *dspFrames);
+    virtual status_t    getNextWriteTimestamp(int64_t *timestamp);
+
+private:
+    uint32_t    mFramesWritten;     // frames played since standby
 };
 
 class AudioStreamInStub : public AudioStreamIn {
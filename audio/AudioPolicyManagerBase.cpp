@@ -38,6 +38,11 @@
 #include <math.h>
 #include <hardware_legacy/audio_policy_conf.h>
 #include <cutils/properties.h>
+#include <cutils/atomic.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace android_audio_legacy {
 
@@ -50,6 +55,8 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
                                                   AudioSystem::device_connection_state state,
                                                   const char *device_address)
 {
+    AutoLatencyTimer timer(this, ENTRY_SET_DEVICE_CONNECTION_STATE);
+    AutoQueryStateUpdate queryStateUpdate(this);
     SortedVector <audio_io_handle_t> outputs;
 
     ALOGV("setDeviceConnectionState() device: %x, state %d, address %s", device, state, device_address);
@@ -64,6 +71,8 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
 
     // handle output devices
     if (audio_is_output_device(device)) {
+        // parked outputs may hold a stream on the device or on a profile about to be probed
+        closeParkedOutputs(true);
 
         if (!mHasA2dp && audio_is_a2dp_device(device)) {
             ALOGE("setDeviceConnectionState() invalid A2DP device: %x", device);
@@ -78,9 +87,12 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
             return BAD_VALUE;
         }
 
+        // coalesce routing and volume commands issued for all outputs by this event
+        AutoRoutingTransaction transaction(this);
+
         // save a copy of the opened output descriptors before any output is opened or closed
         // by checkOutputsForDevice(). This will be needed by checkOutputForAllStrategies()
-        mPreviousOutputs = mOutputs;
+        snapshotOutputs();
         switch (state)
         {
         // handle output device connection
@@ -162,7 +174,7 @@ status_t AudioPolicyManagerBase::setDeviceConnectionState(audio_devices_t device
         // outputs must be closed after checkOutputForAllStrategies() is executed
         if (!outputs.isEmpty()) {
             for (size_t i = 0; i < outputs.size(); i++) {
-                AudioOutputDescriptor *desc = mOutputs.valueFor(outputs[i]);
+                AudioOutputDescriptor *desc = getOutputDesc(outputs[i]);
                 // close unused outputs after device disconnection or direct outputs that have been
                 // opened by checkOutputsForDevice() to query dynamic parameters
                 if ((state == AudioSystem::DEVICE_STATE_UNAVAILABLE) ||
@@ -280,6 +292,8 @@ AudioSystem::device_connection_state AudioPolicyManagerBase::getDeviceConnection
 
 void AudioPolicyManagerBase::setPhoneState(int state)
 {
+    AutoLatencyTimer timer(this, ENTRY_SET_PHONE_STATE);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ALOGV("setPhoneState() state %d", state);
     audio_devices_t newDevice = AUDIO_DEVICE_NONE;
     if (state < 0 || state >= AudioSystem::NUM_MODES) {
@@ -292,6 +306,8 @@ void AudioPolicyManagerBase::setPhoneState(int state)
         return;
     }
 
+    AutoRoutingTransaction transaction(this);
+
     // if leaving call state, handle special case of active streams
     // pertaining to sonification strategy see handleIncallSonification()
     if (isInCall()) {
@@ -312,19 +328,13 @@ void AudioPolicyManagerBase::setPhoneState(int state)
         // force routing command to audio hardware when starting a call
         // even if no device change is needed
         force = true;
-        for (int j = 0; j < DEVICE_CATEGORY_CNT; j++) {
-            mStreams[AUDIO_STREAM_DTMF].mVolumeCurve[j] =
-                    sVolumeProfiles[AUDIO_STREAM_VOICE_CALL][j];
-        }
+        setStreamVolumeCurves(AUDIO_STREAM_DTMF, AUDIO_STREAM_VOICE_CALL);
     } else if (isStateInCall(oldState) && !isStateInCall(state)) {
         ALOGV("  Exiting call in setPhoneState()");
         // force routing command to audio hardware when exiting a call
         // even if no device change is needed
         force = true;
-        for (int j = 0; j < DEVICE_CATEGORY_CNT; j++) {
-            mStreams[AUDIO_STREAM_DTMF].mVolumeCurve[j] =
-                    sVolumeProfiles[AUDIO_STREAM_DTMF][j];
-        }
+        setStreamVolumeCurves(AUDIO_STREAM_DTMF, AUDIO_STREAM_DTMF);
     } else if (isStateInCall(state) && (state != oldState)) {
         ALOGV("  Switching between telephony and VoIP in setPhoneState()");
         // force routing command to audio hardware when switching between telephony and VoIP
@@ -338,7 +348,7 @@ void AudioPolicyManagerBase::setPhoneState(int state)
     checkOutputForAllStrategies();
     updateDevicesAndOutputs();
 
-    AudioOutputDescriptor *hwOutputDesc = mOutputs.valueFor(mPrimaryOutput);
+    AudioOutputDescriptor *hwOutputDesc = getOutputDesc(mPrimaryOutput);
 
     // force routing command to audio hardware when ending call
     // even if no device change is needed
@@ -395,6 +405,8 @@ void AudioPolicyManagerBase::setPhoneState(int state)
 
 void AudioPolicyManagerBase::setForceUse(AudioSystem::force_use usage, AudioSystem::forced_config config)
 {
+    AutoLatencyTimer timer(this, ENTRY_SET_FORCE_USE);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ALOGV("setForceUse() usage %d, config %d, mPhoneState %d", usage, config, mPhoneState);
 
     bool forceVolumeReeval = false;
@@ -452,6 +464,7 @@ void AudioPolicyManagerBase::setForceUse(AudioSystem::force_use usage, AudioSyst
     }
 
     // check for device and output changes triggered by new force usage
+    AutoRoutingTransaction transaction(this);
     checkA2dpSuspend();
     checkOutputForAllStrategies();
     updateDevicesAndOutputs();
@@ -499,32 +512,15 @@ AudioPolicyManagerBase::IOProfile *AudioPolicyManagerBase::getProfileForDirectOu
                                                                uint32_t channelMask,
                                                                audio_output_flags_t flags)
 {
-    for (size_t i = 0; i < mHwModules.size(); i++) {
-        if (mHwModules[i]->mHandle == 0) {
-            continue;
-        }
-        for (size_t j = 0; j < mHwModules[i]->mOutputProfiles.size(); j++) {
-            IOProfile *profile = mHwModules[i]->mOutputProfiles[j];
-            if (flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) {
-                if (profile->isCompatibleProfile(device, samplingRate, format,
-                                           channelMask,
-                                           AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD)) {
-                    if (mAvailableOutputDevices & profile->mSupportedDevices) {
-                        return mHwModules[i]->mOutputProfiles[j];
-                    }
-                }
-            } else {
-                if (profile->isCompatibleProfile(device, samplingRate, format,
-                                           channelMask,
-                                           AUDIO_OUTPUT_FLAG_DIRECT)) {
-                    if (mAvailableOutputDevices & profile->mSupportedDevices) {
-                        return mHwModules[i]->mOutputProfiles[j];
-                    }
-                }
-            }
-        }
+    if (mAvailableOutputDevices == AUDIO_DEVICE_NONE) {
+        return 0;
     }
-    return 0;
+    audio_output_flags_t profileFlags = (flags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) ?
+            AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD : AUDIO_OUTPUT_FLAG_DIRECT;
+
+    updateProfileIndex();
+    return mOutputProfileIndex.find(device, samplingRate, format, channelMask,
+                                    profileFlags, mAvailableOutputDevices);
 }
 
 audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type stream,
@@ -534,6 +530,7 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
                                     AudioSystem::output_flags flags,
                                     const audio_offload_info_t *offloadInfo)
 {
+    AutoLatencyTimer timer(this, ENTRY_GET_OUTPUT);
     audio_io_handle_t output = 0;
     uint32_t latency = 0;
     routing_strategy strategy = getStrategy((AudioSystem::stream_type)stream);
@@ -598,6 +595,7 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
                                            (audio_output_flags_t)flags);
     }
 
+    closeParkedOutputs(false);
     if (profile != NULL) {
         AudioOutputDescriptor *outputDesc = NULL;
 
@@ -619,6 +617,10 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
         if (outputDesc != NULL) {
             closeOutput(outputDesc->mId);
         }
+        output = unparkOutput(profile, samplingRate, format, channelMask, offloadInfo);
+        if (output != 0) {
+            return output;
+        }
         outputDesc = new AudioOutputDescriptor(profile);
         outputDesc->mDevice = device;
         outputDesc->mSamplingRate = samplingRate;
@@ -629,6 +631,10 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
         outputDesc->mRefCount[stream] = 0;
         outputDesc->mStopTime[stream] = 0;
         outputDesc->mDirectOpenCount = 1;
+        if (offloadInfo != NULL) {
+            outputDesc->mOffloadInfo = *offloadInfo;
+            outputDesc->mHasOffloadInfo = true;
+        }
         output = mpClientInterface->openOutput(profile->mModule->mHandle,
                                         &outputDesc->mDevice,
                                         &outputDesc->mSamplingRate,
@@ -659,7 +665,7 @@ audio_io_handle_t AudioPolicyManagerBase::getOutput(AudioSystem::stream_type str
         if (dstOutput == output) {
             mpClientInterface->moveEffects(AUDIO_SESSION_OUTPUT_MIX, srcOutput, dstOutput);
         }
-        mPreviousOutputs = mOutputs;
+        snapshotOutputs();
         ALOGV("getOutput() returns new direct output %d", output);
         return output;
     }
@@ -706,7 +712,7 @@ audio_io_handle_t AudioPolicyManagerBase::selectOutput(const SortedVector<audio_
     audio_io_handle_t outputPrimary = 0;
 
     for (size_t i = 0; i < outputs.size(); i++) {
-        AudioOutputDescriptor *outputDesc = mOutputs.valueFor(outputs[i]);
+        AudioOutputDescriptor *outputDesc = getOutputDesc(outputs[i]);
         if (!outputDesc->isDuplicated()) {
             int commonFlags = (int)AudioSystem::popCount(outputDesc->mProfile->mFlags & flags);
             if (commonFlags > maxCommonFlags) {
@@ -734,7 +740,10 @@ status_t AudioPolicyManagerBase::startOutput(audio_io_handle_t output,
                                              AudioSystem::stream_type stream,
                                              int session)
 {
+    AutoLatencyTimer timer(this, ENTRY_START_OUTPUT);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ALOGV("startOutput() output %d, stream %d, session %d", output, stream, session);
+    closeParkedOutputs(false);
     ssize_t index = mOutputs.indexOfKey(output);
     if (index < 0) {
         ALOGW("startOutput() unknow output %d", output);
@@ -802,7 +811,10 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
                                             AudioSystem::stream_type stream,
                                             int session)
 {
+    AutoLatencyTimer timer(this, ENTRY_STOP_OUTPUT);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ALOGV("stopOutput() output %d, stream %d, session %d", output, stream, session);
+    closeParkedOutputs(false);
     ssize_t index = mOutputs.indexOfKey(output);
     if (index < 0) {
         ALOGW("stopOutput() unknow output %d", output);
@@ -821,7 +833,7 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
         outputDesc->changeRefCount(stream, -1);
         // store time at which the stream was stopped - see isStreamActive()
         if (outputDesc->mRefCount[stream] == 0) {
-            outputDesc->mStopTime[stream] = systemTime();
+            outputDesc->setStopTime(stream, systemTime());
             audio_devices_t newDevice = getNewDevice(output, false /*fromCache*/);
             // delay the device switch by twice the latency because stopOutput() is executed when
             // the track stop() command is received and at that time the audio track buffer can
@@ -858,6 +870,8 @@ status_t AudioPolicyManagerBase::stopOutput(audio_io_handle_t output,
 void AudioPolicyManagerBase::releaseOutput(audio_io_handle_t output)
 {
     ALOGV("releaseOutput() %d", output);
+    AutoQueryStateUpdate queryStateUpdate(this);
+    closeParkedOutputs(false);
     ssize_t index = mOutputs.indexOfKey(output);
     if (index < 0) {
         ALOGW("releaseOutput() releasing unknown output %d", output);
@@ -870,8 +884,9 @@ void AudioPolicyManagerBase::releaseOutput(audio_io_handle_t output)
         AudioOutputDescriptor *outputDesc = mOutputs.valueAt(index);
         if (outputDesc->isActive()) {
             mpClientInterface->closeOutput(output);
-            delete mOutputs.valueAt(index);
-            mOutputs.removeItem(output);
+            removeOutput(output);
+            delete outputDesc;
+            mOutputsClosed++;
             mTestOutputs[testIndex] = 0;
         }
         return;
@@ -885,7 +900,7 @@ void AudioPolicyManagerBase::releaseOutput(audio_io_handle_t output)
                                                               desc->mDirectOpenCount, output);
             return;
         }
-        if (--desc->mDirectOpenCount == 0) {
+        if (--desc->mDirectOpenCount == 0 && !parkOutput(output)) {
             closeOutput(output);
             // If effects where present on the output, audioflinger moved them to the primary
             // output by default: move them back to the appropriate output.
@@ -980,6 +995,7 @@ audio_io_handle_t AudioPolicyManagerBase::getInput(int inputSource,
 status_t AudioPolicyManagerBase::startInput(audio_io_handle_t input)
 {
     ALOGV("startInput() input %d", input);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ssize_t index = mInputs.indexOfKey(input);
     if (index < 0) {
         ALOGW("startInput() unknow input %d", input);
@@ -1036,6 +1052,7 @@ status_t AudioPolicyManagerBase::startInput(audio_io_handle_t input)
 status_t AudioPolicyManagerBase::stopInput(audio_io_handle_t input)
 {
     ALOGV("stopInput() input %d", input);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ssize_t index = mInputs.indexOfKey(input);
     if (index < 0) {
         ALOGW("stopInput() unknow input %d", input);
@@ -1064,6 +1081,7 @@ status_t AudioPolicyManagerBase::stopInput(audio_io_handle_t input)
 void AudioPolicyManagerBase::releaseInput(audio_io_handle_t input)
 {
     ALOGV("releaseInput() %d", input);
+    AutoQueryStateUpdate queryStateUpdate(this);
     ssize_t index = mInputs.indexOfKey(input);
     if (index < 0) {
         ALOGW("releaseInput() releasing unknown input %d", input);
@@ -1084,8 +1102,12 @@ void AudioPolicyManagerBase::initStreamVolume(AudioSystem::stream_type stream,
         ALOGW("initStreamVolume() invalid index limits for stream %d, min %d, max %d", stream , indexMin, indexMax);
         return;
     }
+    if (mStreams[stream].mIndexMin == indexMin && mStreams[stream].mIndexMax == indexMax) {
+        return;
+    }
     mStreams[stream].mIndexMin = indexMin;
     mStreams[stream].mIndexMax = indexMax;
+    mStreams[stream].updateVolumeTables();
 }
 
 status_t AudioPolicyManagerBase::setStreamVolumeIndex(AudioSystem::stream_type stream,
@@ -1109,9 +1131,9 @@ status_t AudioPolicyManagerBase::setStreamVolumeIndex(AudioSystem::stream_type s
     // if device is AUDIO_DEVICE_OUT_DEFAULT set default value and
     // clear all device specific values
     if (device == AUDIO_DEVICE_OUT_DEFAULT) {
-        mStreams[stream].mIndexCur.clear();
+        mStreams[stream].clearVolumeIndexes();
     }
-    mStreams[stream].mIndexCur.add(device, index);
+    mStreams[stream].setVolumeIndex(device, index);
 
     // compute and apply stream volume on all outputs according to connected device
     status_t status = NO_ERROR;
@@ -1169,7 +1191,7 @@ audio_io_handle_t AudioPolicyManagerBase::selectOutputForEffects(
     audio_io_handle_t outputDeepBuffer = 0;
 
     for (size_t i = 0; i < outputs.size(); i++) {
-        AudioOutputDescriptor *desc = mOutputs.valueFor(outputs[i]);
+        AudioOutputDescriptor *desc = getOutputDesc(outputs[i]);
         ALOGV("selectOutputForEffects outputs[%d] flags %x", i, desc->mFlags);
         if ((desc->mFlags & AUDIO_OUTPUT_FLAG_COMPRESS_OFFLOAD) != 0) {
             outputOffloaded = outputs[i];
@@ -1239,6 +1261,7 @@ status_t AudioPolicyManagerBase::registerEffect(const effect_descriptor_t *desc,
     pDesc->mEnabled = false;
 
     mEffects.add(id, pDesc);
+    addEffectToIndex(id, pDesc);
 
     return NO_ERROR;
 }
@@ -1264,6 +1287,7 @@ status_t AudioPolicyManagerBase::unregisterEffect(int id)
     ALOGV("unregisterEffect() effect %s, ID %d, memory %d total memory %d",
             pDesc->mDesc.name, id, pDesc->mDesc.memoryUsage, mTotalEffectsMemory);
 
+    removeEffectFromIndex(id, pDesc);
     mEffects.removeItem(id);
     delete pDesc;
 
@@ -1307,41 +1331,169 @@ status_t AudioPolicyManagerBase::setEffectEnabled(EffectDescriptor *pDesc, bool
         ALOGV("setEffectEnabled(false) total CPU %d", mTotalEffectsCpuLoad);
     }
     pDesc->mEnabled = enabled;
+
+    ssize_t index = mEffectIoUsage.indexOfKey(pDesc->mIo);
+    if (index >= 0) {
+        EffectIoUsage& usage = mEffectIoUsage.editValueAt(index);
+        if (enabled) {
+            usage.mEnabledCount++;
+            usage.mCpuLoad += pDesc->mDesc.cpuLoad;
+        } else {
+            usage.mEnabledCount--;
+            usage.mCpuLoad -= (pDesc->mDesc.cpuLoad < usage.mCpuLoad) ?
+                    pDesc->mDesc.cpuLoad : usage.mCpuLoad;
+        }
+    }
+    if (pDesc->preventsOffload()) {
+        if (enabled) {
+            mNonOffloadableEffectsEnabled++;
+        } else {
+            mNonOffloadableEffectsEnabled--;
+        }
+    }
     return NO_ERROR;
 }
 
 bool AudioPolicyManagerBase::isNonOffloadableEffectEnabled()
 {
-    for (size_t i = 0; i < mEffects.size(); i++) {
-        const EffectDescriptor * const pDesc = mEffects.valueAt(i);
-        if (pDesc->mEnabled && (pDesc->mStrategy == STRATEGY_MEDIA) &&
-                ((pDesc->mDesc.flags & EFFECT_FLAG_OFFLOAD_SUPPORTED) == 0)) {
-            ALOGV("isNonOffloadableEffectEnabled() non offloadable effect %s enabled on session %d",
-                  pDesc->mDesc.name, pDesc->mSession);
-            return true;
+    ALOGV_IF(mNonOffloadableEffectsEnabled != 0,
+             "isNonOffloadableEffectEnabled() %d non offloadable effects enabled",
+             mNonOffloadableEffectsEnabled);
+    return mNonOffloadableEffectsEnabled != 0;
+}
+
+void AudioPolicyManagerBase::addEffectToIndex(int id, const EffectDescriptor *pDesc)
+{
+    ssize_t index = mEffectSessions.indexOfKey(pDesc->mSession);
+    if (index < 0) {
+        index = mEffectSessions.add(pDesc->mSession, SortedVector<int>());
+    }
+    mEffectSessions.editValueAt(index).add(id);
+    addEffectIoUsage(pDesc);
+}
+
+void AudioPolicyManagerBase::removeEffectFromIndex(int id, const EffectDescriptor *pDesc)
+{
+    ssize_t index = mEffectSessions.indexOfKey(pDesc->mSession);
+    if (index >= 0) {
+        mEffectSessions.editValueAt(index).remove(id);
+        if (mEffectSessions.valueAt(index).isEmpty()) {
+            mEffectSessions.removeItemsAt(index);
         }
     }
-    return false;
+    removeEffectIoUsage(pDesc);
+}
+
+void AudioPolicyManagerBase::addEffectIoUsage(const EffectDescriptor *pDesc)
+{
+    ssize_t index = mEffectIoUsage.indexOfKey(pDesc->mIo);
+    if (index < 0) {
+        index = mEffectIoUsage.add(pDesc->mIo, EffectIoUsage());
+    }
+    EffectIoUsage& usage = mEffectIoUsage.editValueAt(index);
+    usage.mEffectCount++;
+    usage.mMemory += pDesc->mDesc.memoryUsage;
+    if (pDesc->mEnabled) {
+        usage.mEnabledCount++;
+        usage.mCpuLoad += pDesc->mDesc.cpuLoad;
+    }
+}
+
+void AudioPolicyManagerBase::removeEffectIoUsage(const EffectDescriptor *pDesc)
+{
+    ssize_t index = mEffectIoUsage.indexOfKey(pDesc->mIo);
+    if (index < 0) {
+        return;
+    }
+    EffectIoUsage& usage = mEffectIoUsage.editValueAt(index);
+    usage.mEffectCount--;
+    usage.mMemory -= (pDesc->mDesc.memoryUsage < usage.mMemory) ?
+            pDesc->mDesc.memoryUsage : usage.mMemory;
+    if (pDesc->mEnabled) {
+        usage.mEnabledCount--;
+        usage.mCpuLoad -= (pDesc->mDesc.cpuLoad < usage.mCpuLoad) ?
+                pDesc->mDesc.cpuLoad : usage.mCpuLoad;
+    }
+    if (usage.mEffectCount == 0) {
+        mEffectIoUsage.removeItemsAt(index);
+    }
+}
+
+void AudioPolicyManagerBase::setEffectIo(EffectDescriptor *pDesc, audio_io_handle_t io)
+{
+    if (pDesc->mIo == io) {
+        return;
+    }
+    removeEffectIoUsage(pDesc);
+    pDesc->mIo = io;
+    addEffectIoUsage(pDesc);
 }
 
 bool AudioPolicyManagerBase::isStreamActive(int stream, uint32_t inPastMs) const
 {
-    nsecs_t sysTime = systemTime();
-    for (size_t i = 0; i < mOutputs.size(); i++) {
-        const AudioOutputDescriptor *outputDesc = mOutputs.valueAt(i);
-        if (outputDesc->isStreamActive((AudioSystem::stream_type)stream, inPastMs, sysTime)) {
-            return true;
-        }
+    if (stream < 0 || stream >= AudioSystem::NUM_STREAM_TYPES) {
+        return false;
     }
-    return false;
+    if (!readsQueryState()) {
+        return isStreamActiveOnOutputs(stream, inPastMs, false);
+    }
+    QueryState state;
+    readQueryState(state);
+    if (state.mStreamRefCount[stream] != 0) {
+        return true;
+    }
+    return (inPastMs != 0) && (ns2ms(systemTime() - state.mStreamStopTime[stream]) < inPastMs);
 }
 
 bool AudioPolicyManagerBase::isStreamActiveRemotely(int stream, uint32_t inPastMs) const
+{
+    if (stream < 0 || stream >= AudioSystem::NUM_STREAM_TYPES) {
+        return false;
+    }
+    if (!readsQueryState()) {
+        return isStreamActiveOnOutputs(stream, inPastMs, true);
+    }
+    QueryState state;
+    readQueryState(state);
+    if (state.mRemoteRefCount[stream] != 0) {
+        return true;
+    }
+    return (inPastMs != 0) && (ns2ms(systemTime() - state.mRemoteStopTime[stream]) < inPastMs);
+}
+
+bool AudioPolicyManagerBase::isSourceActive(audio_source_t source) const
+{
+    if (!readsQueryState()) {
+        for (size_t i = 0; i < mInputs.size(); i++) {
+            const AudioInputDescriptor * inputDescriptor = mInputs.valueAt(i);
+            if ((inputDescriptor->mInputSource == (int)source ||
+                    (source == (audio_source_t)AUDIO_SOURCE_VOICE_RECOGNITION &&
+                     inputDescriptor->mInputSource == AUDIO_SOURCE_HOTWORD))
+                 && (inputDescriptor->mRefCount > 0)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    QueryState state;
+    readQueryState(state);
+    if (source == (audio_source_t)AUDIO_SOURCE_HOTWORD) {
+        return state.mHotwordActive;
+    }
+    if (source == (audio_source_t)AUDIO_SOURCE_VOICE_RECOGNITION && state.mHotwordActive) {
+        return true;
+    }
+    return ((uint32_t)source < 32) && ((state.mActiveSources & (1 << source)) != 0);
+}
+
+bool AudioPolicyManagerBase::isStreamActiveOnOutputs(int stream,
+                                                     uint32_t inPastMs,
+                                                     bool remoteOnly) const
 {
     nsecs_t sysTime = systemTime();
     for (size_t i = 0; i < mOutputs.size(); i++) {
         const AudioOutputDescriptor *outputDesc = mOutputs.valueAt(i);
-        if (((outputDesc->device() & APM_AUDIO_OUT_DEVICE_REMOTE_ALL) != 0) &&
+        if ((!remoteOnly || ((outputDesc->device() & APM_AUDIO_OUT_DEVICE_REMOTE_ALL) != 0)) &&
                 outputDesc->isStreamActive((AudioSystem::stream_type)stream, inPastMs, sysTime)) {
             return true;
         }
@@ -1349,18 +1501,102 @@ bool AudioPolicyManagerBase::isStreamActiveRemotely(int stream, uint32_t inPastM
     return false;
 }
 
-bool AudioPolicyManagerBase::isSourceActive(audio_source_t source) const
+bool AudioPolicyManagerBase::isInPolicyCall() const
+{
+    // mPolicyTid is only set to the calling thread's id by that thread
+    return mPolicyTid == gettid();
+}
+
+bool AudioPolicyManagerBase::readsQueryState() const
+{
+    return mQueryStateEnabled && !isInPolicyCall();
+}
+
+void AudioPolicyManagerBase::enterPolicyCall()
+{
+    if (mPolicyCallDepth++ == 0) {
+        mPolicyTid = gettid();
+    }
+}
+
+void AudioPolicyManagerBase::exitPolicyCall()
+{
+    if (--mPolicyCallDepth == 0) {
+        mPolicyTid = 0;
+        if (mQueryStateEnabled) {
+            publishQueryState();
+        }
+    }
+}
+
+void AudioPolicyManagerBase::enableQueryState()
+{
+    publishQueryState();
+    mQueryStateEnabled = true;
+}
+
+void AudioPolicyManagerBase::publishQueryState()
 {
+    // single writer: policy methods are serialized by the caller
+    int32_t seq = mQueryStateSeq + 1;
+    android_atomic_inc(&mQueryStateSeq);
+    // the odd sequence must be visible before any snapshot store
+    android_memory_barrier();
+
+    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
+        mQueryState.mStreamRefCount[i] = 0;
+        mQueryState.mStreamStopTime[i] = 0;
+        mQueryState.mRemoteRefCount[i] = 0;
+        mQueryState.mRemoteStopTime[i] = 0;
+    }
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        const AudioOutputDescriptor *outputDesc = mOutputs.valueAt(i);
+        bool remote = (outputDesc->device() & APM_AUDIO_OUT_DEVICE_REMOTE_ALL) != 0;
+        for (int j = 0; j < AudioSystem::NUM_STREAM_TYPES; j++) {
+            mQueryState.mStreamRefCount[j] += outputDesc->mRefCount[j];
+            if (outputDesc->mStopTime[j] > mQueryState.mStreamStopTime[j]) {
+                mQueryState.mStreamStopTime[j] = outputDesc->mStopTime[j];
+            }
+            if (remote) {
+                mQueryState.mRemoteRefCount[j] += outputDesc->mRefCount[j];
+                if (outputDesc->mStopTime[j] > mQueryState.mRemoteStopTime[j]) {
+                    mQueryState.mRemoteStopTime[j] = outputDesc->mStopTime[j];
+                }
+            }
+        }
+    }
+    for (int i = 0; i < NUM_STRATEGIES; i++) {
+        mQueryState.mDeviceForStrategy[i] = getDeviceForStrategy((routing_strategy)i,
+                                                                 true /*fromCache*/);
+    }
+    mQueryState.mActiveSources = 0;
+    mQueryState.mHotwordActive = false;
     for (size_t i = 0; i < mInputs.size(); i++) {
-        const AudioInputDescriptor * inputDescriptor = mInputs.valueAt(i);
-        if ((inputDescriptor->mInputSource == (int)source ||
-                (source == (audio_source_t)AUDIO_SOURCE_VOICE_RECOGNITION &&
-                 inputDescriptor->mInputSource == AUDIO_SOURCE_HOTWORD))
-             && (inputDescriptor->mRefCount > 0)) {
-            return true;
+        const AudioInputDescriptor *inputDesc = mInputs.valueAt(i);
+        if (inputDesc->mRefCount == 0) {
+            continue;
+        }
+        if (inputDesc->mInputSource == AUDIO_SOURCE_HOTWORD) {
+            mQueryState.mHotwordActive = true;
+        } else if ((uint32_t)inputDesc->mInputSource < 32) {
+            mQueryState.mActiveSources |= 1 << inputDesc->mInputSource;
         }
     }
-    return false;
+
+    android_atomic_release_store(seq + 1, &mQueryStateSeq);
+}
+
+void AudioPolicyManagerBase::readQueryState(QueryState& state) const
+{
+    int32_t seq;
+    do {
+        seq = android_atomic_acquire_load(&mQueryStateSeq);
+        if (seq & 1) {
+            continue;
+        }
+        state = mQueryState;
+        android_memory_barrier();
+    } while ((seq & 1) || (seq != android_atomic_acquire_load(&mQueryStateSeq)));
 }
 
 
@@ -1438,6 +1674,15 @@ status_t AudioPolicyManagerBase::dump(int fd)
     snprintf(buffer, SIZE, "\nTotal Effects CPU: %f MIPS, Total Effects memory: %d KB\n",
             (float)mTotalEffectsCpuLoad/10, mTotalEffectsMemory);
     write(fd, buffer, strlen(buffer));
+    for (size_t i = 0; i < mEffectIoUsage.size(); i++) {
+        const EffectIoUsage& usage = mEffectIoUsage.valueAt(i);
+        snprintf(buffer, SIZE, "- I/O %d: %d effects, %d enabled, CPU: %f MIPS, memory: %d KB\n",
+                 mEffectIoUsage.keyAt(i), usage.mEffectCount, usage.mEnabledCount,
+                 (float)usage.mCpuLoad/10, usage.mMemory);
+        write(fd, buffer, strlen(buffer));
+    }
+    snprintf(buffer, SIZE, "Non offloadable effects enabled: %d\n", mNonOffloadableEffectsEnabled);
+    write(fd, buffer, strlen(buffer));
 
     snprintf(buffer, SIZE, "Registered effects:\n");
     write(fd, buffer, strlen(buffer));
@@ -1447,10 +1692,49 @@ status_t AudioPolicyManagerBase::dump(int fd)
         mEffects.valueAt(i)->dump(fd);
     }
 
+    dumpStats(fd);
 
     return NO_ERROR;
 }
 
+void AudioPolicyManagerBase::dumpStats(int fd)
+{
+    static const char * const entryNames[NUM_ENTRY_POINTS] = {
+        "getOutput",
+        "startOutput",
+        "stopOutput",
+        "setDeviceConnectionState",
+        "setPhoneState",
+        "setForceUse",
+    };
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    snprintf(buffer, SIZE, "\nPolicy statistics:\n");
+    result.append(buffer);
+    snprintf(buffer, SIZE, " Outputs opened: %u closed: %u\n", mOutputsOpened, mOutputsClosed);
+    result.append(buffer);
+    snprintf(buffer, SIZE, " Routing commands: %u volume commands: %u coalesced: %u\n",
+             mRoutingCommandsSent, mVolumeCommandsSent, mCommandsCoalesced);
+    result.append(buffer);
+    snprintf(buffer, SIZE, " Parked outputs: %u/%u ttl: %u ms reused: %u\n",
+             (uint32_t)mParkedOutputs.size(), mMaxParkedOutputs, mParkedOutputTtlMs,
+             mParkedOutputsReused);
+    result.append(buffer);
+    if (!mStatsEnabled) {
+        snprintf(buffer, SIZE, " Latency measurement disabled (set audio.policy.stats to enable)\n");
+        result.append(buffer);
+    }
+    write(fd, result.string(), result.size());
+
+    if (mStatsEnabled) {
+        for (int i = 0; i < NUM_ENTRY_POINTS; i++) {
+            mLatency[i].dump(fd, entryNames[i]);
+        }
+    }
+}
+
 // This function checks for the parameters which can be offloaded.
 // This can be enhanced depending on the capability of the DSP and policy
 // of the system.
@@ -1522,21 +1806,43 @@ bool AudioPolicyManagerBase::isOffloadSupported(const audio_offload_info_t& offl
 // AudioPolicyManagerBase
 // ----------------------------------------------------------------------------
 
-AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface)
+AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface,
+                                               const char *configFile)
     :
 #ifdef AUDIO_POLICY_TEST
     Thread(false),
 #endif //AUDIO_POLICY_TEST
     mPrimaryOutput((audio_io_handle_t)0),
+    mOutputsGeneration(0), mPreviousOutputsGeneration(0),
     mAvailableOutputDevices(AUDIO_DEVICE_NONE),
     mPhoneState(AudioSystem::MODE_NORMAL),
-    mLimitRingtoneVolume(false), mLastVoiceVolume(-1.0f),
-    mTotalEffectsCpuLoad(0), mTotalEffectsMemory(0),
+    mLimitRingtoneVolume(false), mRoutingTableValid(false), mLastVoiceVolume(-1.0f),
+    mTotalEffectsCpuLoad(0), mTotalEffectsMemory(0), mNonOffloadableEffectsEnabled(0),
     mA2dpSuspended(false), mHasA2dp(false), mHasUsb(false), mHasRemoteSubmix(false),
-    mSpeakerDrcEnabled(false)
+    mSpeakerDrcEnabled(false), mProfileIndexValid(false), mRoutingTransactionDepth(0),
+    mMaxParkedOutputs(0), mParkedOutputTtlMs(0),
+    mQueryStateEnabled(false), mQueryStateSeq(0), mPolicyTid(0), mPolicyCallDepth(0),
+    mStatsEnabled(false), mOutputsOpened(0), mOutputsClosed(0),
+    mRoutingCommandsSent(0), mVolumeCommandsSent(0), mCommandsCoalesced(0),
+    mParkedOutputsReused(0)
 {
     mpClientInterface = clientInterface;
 
+    for (uint32_t i = 0; i < OUTPUT_SLOT_CNT; i++) {
+        mOutputSlots[i] = -1;
+    }
+
+    char propValue[PROPERTY_VALUE_MAX];
+    if (property_get("audio.policy.stats", propValue, "0")) {
+        mStatsEnabled = stringToBool(propValue);
+    }
+    if (property_get("audio.policy.parked_outputs", propValue, "0")) {
+        mMaxParkedOutputs = (uint32_t)atoi(propValue);
+    }
+    if (property_get("audio.policy.parked_output_ttl_ms", propValue, "5000")) {
+        mParkedOutputTtlMs = (uint32_t)atoi(propValue);
+    }
+
     for (int i = 0; i < AudioSystem::NUM_FORCE_USE; i++) {
         mForceUse[i] = AudioSystem::FORCE_NONE;
     }
@@ -1545,7 +1851,13 @@ AudioPolicyManagerBase::AudioPolicyManagerBase(AudioPolicyClientInterface *clien
     mScoDeviceAddress = String8("");
     mUsbCardAndDevice = String8("");
 
-    if (loadAudioPolicyConfig(AUDIO_POLICY_VENDOR_CONFIG_FILE) != NO_ERROR) {
+    if (configFile != NULL) {
+        if (loadAudioPolicyConfig(configFile) != NO_ERROR) {
+            ALOGE("could not load audio policy configuration file %s, setting defaults",
+                  configFile);
+            defaultAudioPolicyConfig();
+        }
+    } else if (loadAudioPolicyConfig(AUDIO_POLICY_VENDOR_CONFIG_FILE) != NO_ERROR) {
         if (loadAudioPolicyConfig(AUDIO_POLICY_CONFIG_FILE) != NO_ERROR) {
             ALOGE("could not load audio policy configuration file, setting defaults");
             defaultAudioPolicyConfig();
@@ -1639,6 +1951,7 @@ AudioPolicyManagerBase::~AudioPolicyManagerBase()
 #ifdef AUDIO_POLICY_TEST
     exit();
 #endif //AUDIO_POLICY_TEST
+   closeParkedOutputs(true);
    for (size_t i = 0; i < mOutputs.size(); i++) {
         mpClientInterface->closeOutput(mOutputs.keyAt(i));
         delete mOutputs.valueAt(i);
@@ -1753,13 +2066,13 @@ bool AudioPolicyManagerBase::threadLoop()
             if (param.get(String8("test_cmd_policy_reopen"), value) == NO_ERROR) {
                 param.remove(String8("test_cmd_policy_reopen"));
 
-                AudioOutputDescriptor *outputDesc = mOutputs.valueFor(mPrimaryOutput);
+                AudioOutputDescriptor *outputDesc = getOutputDesc(mPrimaryOutput);
                 mpClientInterface->closeOutput(mPrimaryOutput);
 
                 audio_module_handle_t moduleHandle = outputDesc->mModule->mHandle;
 
-                delete mOutputs.valueFor(mPrimaryOutput);
-                mOutputs.removeItem(mPrimaryOutput);
+                removeOutput(mPrimaryOutput);
+                delete outputDesc;
 
                 AudioOutputDescriptor *outputDesc = new AudioOutputDescriptor(NULL);
                 outputDesc->mDevice = AUDIO_DEVICE_OUT_SPEAKER;
@@ -1809,10 +2122,75 @@ int AudioPolicyManagerBase::testOutputIndex(audio_io_handle_t output)
 
 // ---
 
-void AudioPolicyManagerBase::addOutput(audio_io_handle_t id, AudioOutputDescriptor *outputDesc)
+void AudioPolicyManagerBase::addOutput(audio_io_handle_t id, AudioOutputDescriptor *outputDesc,
+                                       bool opened)
 {
     outputDesc->mId = id;
     mOutputs.add(id, outputDesc);
+    updateOutputSlots();
+    mOutputsGeneration++;
+    if (opened) {
+        mOutputsOpened++;
+    }
+}
+
+void AudioPolicyManagerBase::removeOutput(audio_io_handle_t id)
+{
+    mOutputs.removeItem(id);
+    updateOutputSlots();
+    mOutputsGeneration++;
+}
+
+void AudioPolicyManagerBase::updateOutputSlots()
+{
+    for (uint32_t i = 0; i < OUTPUT_SLOT_CNT; i++) {
+        mOutputSlots[i] = -1;
+    }
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        mOutputSlots[mOutputs.keyAt(i) % OUTPUT_SLOT_CNT] = i;
+    }
+}
+
+AudioPolicyManagerBase::AudioOutputDescriptor *AudioPolicyManagerBase::getOutputDesc(
+        audio_io_handle_t id) const
+{
+    // the slot is only a hint: it is checked against mOutputs so that outputs added or
+    // removed without addOutput()/removeOutput(), e.g. by a subclass, are still found
+    ssize_t index = mOutputSlots[id % OUTPUT_SLOT_CNT];
+    if (index < 0 || (size_t)index >= mOutputs.size() || mOutputs.keyAt(index) != id) {
+        index = mOutputs.indexOfKey(id);
+        if (index < 0) {
+            return NULL;
+        }
+        mOutputSlots[id % OUTPUT_SLOT_CNT] = index;
+    }
+    return mOutputs.valueAt(index);
+}
+
+bool AudioPolicyManagerBase::outputsChangedSinceSnapshot() const
+{
+    if (mPreviousOutputsGeneration != mOutputsGeneration ||
+            mPreviousOutputs.size() != mOutputs.size()) {
+        return true;
+    }
+    // derived policies may modify mOutputs without addOutput() or removeOutput(): both vectors
+    // are sorted by handle, compare them entry by entry
+    for (size_t i = 0; i < mOutputs.size(); i++) {
+        if (mPreviousOutputs.keyAt(i) != mOutputs.keyAt(i) ||
+                mPreviousOutputs.valueAt(i) != mOutputs.valueAt(i)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void AudioPolicyManagerBase::snapshotOutputs()
+{
+    if (!outputsChangedSinceSnapshot()) {
+        return;
+    }
+    mPreviousOutputs = mOutputs;
+    mPreviousOutputsGeneration = mOutputsGeneration;
 }
 
 
@@ -1887,38 +2265,7 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                                                                        &offloadInfo);
             if (output != 0) {
                 if (desc->mFlags & AUDIO_OUTPUT_FLAG_DIRECT) {
-                    String8 reply;
-                    char *value;
-                    if (profile->mSamplingRates[0] == 0) {
-                        reply = mpClientInterface->getParameters(output,
-                                                String8(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES));
-                        ALOGV("checkOutputsForDevice() direct output sup sampling rates %s",
-                                  reply.string());
-                        value = strpbrk((char *)reply.string(), "=");
-                        if (value != NULL) {
-                            loadSamplingRates(value + 1, profile);
-                        }
-                    }
-                    if (profile->mFormats[0] == 0) {
-                        reply = mpClientInterface->getParameters(output,
-                                                       String8(AUDIO_PARAMETER_STREAM_SUP_FORMATS));
-                        ALOGV("checkOutputsForDevice() direct output sup formats %s",
-                                  reply.string());
-                        value = strpbrk((char *)reply.string(), "=");
-                        if (value != NULL) {
-                            loadFormats(value + 1, profile);
-                        }
-                    }
-                    if (profile->mChannelMasks[0] == 0) {
-                        reply = mpClientInterface->getParameters(output,
-                                                      String8(AUDIO_PARAMETER_STREAM_SUP_CHANNELS));
-                        ALOGV("checkOutputsForDevice() direct output sup channel masks %s",
-                                  reply.string());
-                        value = strpbrk((char *)reply.string(), "=");
-                        if (value != NULL) {
-                            loadOutChannels(value + 1, profile);
-                        }
-                    }
+                    loadDynamicOutputParameters(output, profile);
                     if (((profile->mSamplingRates[0] == 0) &&
                              (profile->mSamplingRates.size() < 2)) ||
                          ((profile->mFormats[0] == 0) &&
@@ -1946,8 +2293,8 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                     if (duplicatedOutput != 0) {
                         // add duplicated output descriptor
                         AudioOutputDescriptor *dupOutputDesc = new AudioOutputDescriptor(NULL);
-                        dupOutputDesc->mOutput1 = mOutputs.valueFor(mPrimaryOutput);
-                        dupOutputDesc->mOutput2 = mOutputs.valueFor(output);
+                        dupOutputDesc->mOutput1 = getOutputDesc(mPrimaryOutput);
+                        dupOutputDesc->mOutput2 = getOutputDesc(output);
                         dupOutputDesc->mSamplingRate = desc->mSamplingRate;
                         dupOutputDesc->mFormat = desc->mFormat;
                         dupOutputDesc->mChannelMask = desc->mChannelMask;
@@ -1958,7 +2305,8 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                         ALOGW("checkOutputsForDevice() could not open dup output for %d and %d",
                                 mPrimaryOutput, output);
                         mpClientInterface->closeOutput(output);
-                        mOutputs.removeItem(output);
+                        removeOutput(output);
+                        mOutputsClosed++;
                         output = 0;
                     }
                 }
@@ -2000,6 +2348,7 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
                         (profile->mFlags & AUDIO_OUTPUT_FLAG_DIRECT)) {
                     ALOGV("checkOutputsForDevice(): clearing direct output profile %d on module %d",
                           j, i);
+                    mProfileIndexValid = false;
                     if (profile->mSamplingRates[0] == 0) {
                         profile->mSamplingRates.clear();
                         profile->mSamplingRates.add(0);
@@ -2019,11 +2368,75 @@ status_t AudioPolicyManagerBase::checkOutputsForDevice(audio_devices_t device,
     return NO_ERROR;
 }
 
+void AudioPolicyManagerBase::loadDynamicOutputParameters(audio_io_handle_t output,
+                                                         IOProfile *profile)
+{
+    // query all dynamic parameters in one round trip to the audio HAL
+    String8 keys;
+    if (profile->mSamplingRates[0] == 0) {
+        keys.append(AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES);
+    }
+    if (profile->mFormats[0] == 0) {
+        keys.append(keys.isEmpty() ? "" : ";");
+        keys.append(AUDIO_PARAMETER_STREAM_SUP_FORMATS);
+    }
+    if (profile->mChannelMasks[0] == 0) {
+        keys.append(keys.isEmpty() ? "" : ";");
+        keys.append(AUDIO_PARAMETER_STREAM_SUP_CHANNELS);
+    }
+    if (keys.isEmpty()) {
+        return;
+    }
+    AudioParameter reply = AudioParameter(mpClientInterface->getParameters(output, keys));
+
+    if (profile->mSamplingRates[0] == 0) {
+        String8 value = getDynamicOutputParameter(output, reply,
+                                                  AUDIO_PARAMETER_STREAM_SUP_SAMPLING_RATES);
+        ALOGV("checkOutputsForDevice() direct output sup sampling rates %s", value.string());
+        if (!value.isEmpty()) {
+            loadSamplingRates((char *)value.string(), profile);
+        }
+    }
+    if (profile->mFormats[0] == 0) {
+        String8 value = getDynamicOutputParameter(output, reply,
+                                                  AUDIO_PARAMETER_STREAM_SUP_FORMATS);
+        ALOGV("checkOutputsForDevice() direct output sup formats %s", value.string());
+        if (!value.isEmpty()) {
+            loadFormats((char *)value.string(), profile);
+        }
+    }
+    if (profile->mChannelMasks[0] == 0) {
+        String8 value = getDynamicOutputParameter(output, reply,
+                                                  AUDIO_PARAMETER_STREAM_SUP_CHANNELS);
+        ALOGV("checkOutputsForDevice() direct output sup channel masks %s", value.string());
+        if (!value.isEmpty()) {
+            loadOutChannels((char *)value.string(), profile);
+        }
+    }
+}
+
+String8 AudioPolicyManagerBase::getDynamicOutputParameter(audio_io_handle_t output,
+                                                          AudioParameter& reply,
+                                                          const char *key)
+{
+    String8 value;
+    if (reply.get(String8(key), value) == NO_ERROR) {
+        return value;
+    }
+    // some audio HALs only answer the first key of a query: ask for this one alone
+    String8 single = mpClientInterface->getParameters(output, String8(key));
+    const char *separator = strpbrk(single.string(), "=");
+    if (separator != NULL) {
+        value = String8(separator + 1);
+    }
+    return value;
+}
+
 void AudioPolicyManagerBase::closeOutput(audio_io_handle_t output)
 {
     ALOGV("closeOutput(%d)", output);
 
-    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(output);
+    AudioOutputDescriptor *outputDesc = getOutputDesc(output);
     if (outputDesc == NULL) {
         ALOGW("closeOutput() unknown output %d", output);
         return;
@@ -2052,57 +2465,183 @@ void AudioPolicyManagerBase::closeOutput(audio_io_handle_t output)
             audio_io_handle_t duplicatedOutput = mOutputs.keyAt(i);
             ALOGV("closeOutput() closing also duplicated output %d", duplicatedOutput);
 
+            discardRoutingCommands(duplicatedOutput);
             mpClientInterface->closeOutput(duplicatedOutput);
-            delete mOutputs.valueFor(duplicatedOutput);
-            mOutputs.removeItem(duplicatedOutput);
+            removeOutput(duplicatedOutput);
+            delete dupOutputDesc;
+            mOutputsClosed++;
         }
     }
 
+    discardRoutingCommands(output);
+
     AudioParameter param;
     param.add(String8("closing"), String8("true"));
     mpClientInterface->setParameters(output, param.toString());
 
     mpClientInterface->closeOutput(output);
+    removeOutput(output);
     delete outputDesc;
-    mOutputs.removeItem(output);
-    mPreviousOutputs = mOutputs;
+    mOutputsClosed++;
+    snapshotOutputs();
 }
 
-SortedVector<audio_io_handle_t> AudioPolicyManagerBase::getOutputsForDevice(audio_devices_t device,
-                        DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> openOutputs)
+bool AudioPolicyManagerBase::parkOutput(audio_io_handle_t output)
 {
-    SortedVector<audio_io_handle_t> outputs;
-
-    ALOGVV("getOutputsForDevice() device %04x", device);
-    for (size_t i = 0; i < openOutputs.size(); i++) {
-        ALOGVV("output %d isDuplicated=%d device=%04x",
-                i, openOutputs.valueAt(i)->isDuplicated(), openOutputs.valueAt(i)->supportedDevices());
-        if ((device & openOutputs.valueAt(i)->supportedDevices()) == device) {
-            ALOGVV("getOutputsForDevice() found output %d", openOutputs.keyAt(i));
-            outputs.add(openOutputs.keyAt(i));
-        }
+    if (mMaxParkedOutputs == 0) {
+        return false;
     }
-    return outputs;
-}
-
-bool AudioPolicyManagerBase::vectorsEqual(SortedVector<audio_io_handle_t>& outputs1,
-                                   SortedVector<audio_io_handle_t>& outputs2)
-{
-    if (outputs1.size() != outputs2.size()) {
+    AudioOutputDescriptor *outputDesc = getOutputDesc(output);
+    if (outputDesc == NULL || outputDesc->isDuplicated()) {
         return false;
     }
-    for (size_t i = 0; i < outputs1.size(); i++) {
-        if (outputs1[i] != outputs2[i]) {
-            return false;
-        }
+    ALOGV("parkOutput(%d)", output);
+
+    if (mParkedOutputs.size() >= mMaxParkedOutputs) {
+        closeParkedOutput(0);
+    }
+    discardRoutingCommands(output);
+    removeOutput(output);
+    snapshotOutputs();
+
+    ParkedOutput parked;
+    parked.mId = output;
+    parked.mDesc = outputDesc;
+    parked.mParkTime = systemTime();
+    mParkedOutputs.add(parked);
+
+    // the output stays open in audioflinger: move effects it may hold to the appropriate output
+    audio_io_handle_t dstOutput = getOutputForEffect();
+    if (dstOutput != 0) {
+        mpClientInterface->moveEffects(AUDIO_SESSION_OUTPUT_MIX, output, dstOutput);
     }
     return true;
 }
 
-void AudioPolicyManagerBase::checkOutputForStrategy(routing_strategy strategy)
+audio_io_handle_t AudioPolicyManagerBase::unparkOutput(IOProfile *profile,
+                                                       uint32_t samplingRate,
+                                                       uint32_t format,
+                                                       uint32_t channelMask,
+                                                       const audio_offload_info_t *offloadInfo)
 {
-    audio_devices_t oldDevice = getDeviceForStrategy(strategy, true /*fromCache*/);
+    size_t i = 0;
+    while (i < mParkedOutputs.size()) {
+        AudioOutputDescriptor *desc = mParkedOutputs[i].mDesc;
+        if (desc->mProfile != profile) {
+            i++;
+            continue;
+        }
+        if ((samplingRate != desc->mSamplingRate) ||
+                (format != desc->mFormat) ||
+                (channelMask != desc->mChannelMask) ||
+                !isSameOffloadInfo(desc, offloadInfo)) {
+            closeParkedOutput(i);
+            continue;
+        }
+        audio_io_handle_t output = mParkedOutputs[i].mId;
+        mParkedOutputs.removeAt(i);
+        desc->mDirectOpenCount = 1;
+        mParkedOutputsReused++;
+
+        audio_io_handle_t srcOutput = getOutputForEffect();
+        addOutput(output, desc, false);
+        audio_io_handle_t dstOutput = getOutputForEffect();
+        if (dstOutput == output) {
+            mpClientInterface->moveEffects(AUDIO_SESSION_OUTPUT_MIX, srcOutput, dstOutput);
+        }
+        snapshotOutputs();
+        ALOGV("unparkOutput() reusing parked direct output %d", output);
+        return output;
+    }
+    return 0;
+}
+
+void AudioPolicyManagerBase::closeParkedOutputs(bool all)
+{
+    if (mParkedOutputs.isEmpty()) {
+        return;
+    }
+    nsecs_t expiry = systemTime() - milliseconds(mParkedOutputTtlMs);
+    // outputs are parked in chronological order
+    while (!mParkedOutputs.isEmpty() && (all || mParkedOutputs[0].mParkTime <= expiry)) {
+        closeParkedOutput(0);
+    }
+}
+
+void AudioPolicyManagerBase::closeParkedOutput(size_t index)
+{
+    audio_io_handle_t output = mParkedOutputs[index].mId;
+    ALOGV("closeParkedOutput(%d)", output);
+
+    AudioParameter param;
+    param.add(String8("closing"), String8("true"));
+    mpClientInterface->setParameters(output, param.toString());
+
+    mpClientInterface->closeOutput(output);
+    delete mParkedOutputs[index].mDesc;
+    mParkedOutputs.removeAt(index);
+    mOutputsClosed++;
+}
+
+bool AudioPolicyManagerBase::isSameOffloadInfo(const AudioOutputDescriptor *desc,
+                                               const audio_offload_info_t *offloadInfo)
+{
+    if (offloadInfo == NULL || !desc->mHasOffloadInfo) {
+        return offloadInfo == NULL && !desc->mHasOffloadInfo;
+    }
+    // compare fields one by one: the structure may contain padding
+    const audio_offload_info_t *info = &desc->mOffloadInfo;
+    return (info->sample_rate == offloadInfo->sample_rate) &&
+            (info->channel_mask == offloadInfo->channel_mask) &&
+            (info->format == offloadInfo->format) &&
+            (info->stream_type == offloadInfo->stream_type) &&
+            (info->bit_rate == offloadInfo->bit_rate) &&
+            (info->duration_us == offloadInfo->duration_us) &&
+            (info->has_video == offloadInfo->has_video) &&
+            (info->is_streaming == offloadInfo->is_streaming);
+}
+
+SortedVector<audio_io_handle_t> AudioPolicyManagerBase::getOutputsForDevice(audio_devices_t device,
+                        const DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *>& openOutputs)
+{
+    SortedVector<audio_io_handle_t> outputs;
+
+    ALOGVV("getOutputsForDevice() device %04x", device);
+    for (size_t i = 0; i < openOutputs.size(); i++) {
+        ALOGVV("output %d isDuplicated=%d device=%04x",
+                i, openOutputs.valueAt(i)->isDuplicated(), openOutputs.valueAt(i)->supportedDevices());
+        if ((device & openOutputs.valueAt(i)->supportedDevices()) == device) {
+            ALOGVV("getOutputsForDevice() found output %d", openOutputs.keyAt(i));
+            outputs.add(openOutputs.keyAt(i));
+        }
+    }
+    return outputs;
+}
+
+bool AudioPolicyManagerBase::vectorsEqual(SortedVector<audio_io_handle_t>& outputs1,
+                                   SortedVector<audio_io_handle_t>& outputs2)
+{
+    if (outputs1.size() != outputs2.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < outputs1.size(); i++) {
+        if (outputs1[i] != outputs2[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void AudioPolicyManagerBase::checkOutputForStrategy(routing_strategy strategy)
+{
+    audio_devices_t oldDevice = getDeviceForStrategy(strategy, true /*fromCache*/);
     audio_devices_t newDevice = getDeviceForStrategy(strategy, false /*fromCache*/);
+
+    // same device and no output opened or closed since mPreviousOutputs was taken:
+    // source and destination outputs are necessarily identical
+    if (oldDevice == newDevice && !outputsChangedSinceSnapshot()) {
+        return;
+    }
     SortedVector<audio_io_handle_t> srcOutputs = getOutputsForDevice(oldDevice, mPreviousOutputs);
     SortedVector<audio_io_handle_t> dstOutputs = getOutputsForDevice(newDevice, mOutputs);
 
@@ -2111,29 +2650,35 @@ void AudioPolicyManagerBase::checkOutputForStrategy(routing_strategy strategy)
               strategy, srcOutputs[0], dstOutputs[0]);
         // mute strategy while moving tracks from one output to another
         for (size_t i = 0; i < srcOutputs.size(); i++) {
-            AudioOutputDescriptor *desc = mOutputs.valueFor(srcOutputs[i]);
+            AudioOutputDescriptor *desc = getOutputDesc(srcOutputs[i]);
             if (desc->isStrategyActive(strategy)) {
                 setStrategyMute(strategy, true, srcOutputs[i]);
                 setStrategyMute(strategy, false, srcOutputs[i], MUTE_TIME_MS, newDevice);
             }
         }
+        // the strategy must be muted before its tracks are moved
+        flushRoutingCommands();
 
         // Move effects associated to this strategy from previous output to new output
         if (strategy == STRATEGY_MEDIA) {
             audio_io_handle_t fxOutput = selectOutputForEffects(dstOutputs);
             SortedVector<audio_io_handle_t> moved;
-            for (size_t i = 0; i < mEffects.size(); i++) {
-                EffectDescriptor *desc = mEffects.valueAt(i);
-                if (desc->mSession == AUDIO_SESSION_OUTPUT_MIX &&
-                        desc->mIo != fxOutput) {
+            ssize_t index = mEffectSessions.indexOfKey(AUDIO_SESSION_OUTPUT_MIX);
+            if (index >= 0) {
+                const SortedVector<int>& ids = mEffectSessions.valueAt(index);
+                for (size_t i = 0; i < ids.size(); i++) {
+                    EffectDescriptor *desc = mEffects.valueFor(ids[i]);
+                    if (desc->mIo == fxOutput) {
+                        continue;
+                    }
                     if (moved.indexOf(desc->mIo) < 0) {
                         ALOGV("checkOutputForStrategy() moving effect %d to output %d",
-                              mEffects.keyAt(i), fxOutput);
+                              ids[i], fxOutput);
                         mpClientInterface->moveEffects(AUDIO_SESSION_OUTPUT_MIX, desc->mIo,
                                                        fxOutput);
                         moved.add(desc->mIo);
                     }
-                    desc->mIo = fxOutput;
+                    setEffectIo(desc, fxOutput);
                 }
             }
         }
@@ -2150,12 +2695,51 @@ void AudioPolicyManagerBase::checkOutputForStrategy(routing_strategy strategy)
 
 void AudioPolicyManagerBase::checkOutputForAllStrategies()
 {
-    checkOutputForStrategy(STRATEGY_ENFORCED_AUDIBLE);
-    checkOutputForStrategy(STRATEGY_PHONE);
-    checkOutputForStrategy(STRATEGY_SONIFICATION);
-    checkOutputForStrategy(STRATEGY_SONIFICATION_RESPECTFUL);
-    checkOutputForStrategy(STRATEGY_MEDIA);
-    checkOutputForStrategy(STRATEGY_DTMF);
+    // strategies in order of priority
+    static const routing_strategy strategies[] = {
+        STRATEGY_ENFORCED_AUDIBLE,
+        STRATEGY_PHONE,
+        STRATEGY_SONIFICATION,
+        STRATEGY_SONIFICATION_RESPECTFUL,
+        STRATEGY_MEDIA,
+        STRATEGY_DTMF
+    };
+
+    // supported devices of the outputs opened or closed since mPreviousOutputs was taken
+    Vector <audio_devices_t> changedDevices;
+    if (outputsChangedSinceSnapshot()) {
+        for (size_t i = 0; i < mPreviousOutputs.size(); i++) {
+            if (mOutputs.indexOfKey(mPreviousOutputs.keyAt(i)) < 0) {
+                changedDevices.add(mPreviousOutputs.valueAt(i)->supportedDevices());
+            }
+        }
+        for (size_t i = 0; i < mOutputs.size(); i++) {
+            // also catches a descriptor replaced by a derived policy under the same handle
+            if (mPreviousOutputs.valueFor(mOutputs.keyAt(i)) != mOutputs.valueAt(i)) {
+                changedDevices.add(mOutputs.valueAt(i)->supportedDevices());
+            }
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(strategies)/sizeof(strategies[0]); i++) {
+        routing_strategy strategy = strategies[i];
+        audio_devices_t device = getDeviceForStrategy(strategy, true /*fromCache*/);
+        // the outputs used by a strategy can only change if its device changes or if an output
+        // supporting its device was opened or closed
+        if (device == getDeviceForStrategy(strategy, false /*fromCache*/)) {
+            size_t j;
+            for (j = 0; j < changedDevices.size(); j++) {
+                if ((device & changedDevices[j]) == device) {
+                    break;
+                }
+            }
+            if (j == changedDevices.size()) {
+                ALOGVV("checkOutputForAllStrategies() strategy %d not affected", strategy);
+                continue;
+            }
+        }
+        checkOutputForStrategy(strategy);
+    }
 }
 
 audio_io_handle_t AudioPolicyManagerBase::getA2dpOutput()
@@ -2223,7 +2807,7 @@ audio_devices_t AudioPolicyManagerBase::getNewDevice(audio_io_handle_t output, b
 {
     audio_devices_t device = AUDIO_DEVICE_NONE;
 
-    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(output);
+    AudioOutputDescriptor *outputDesc = getOutputDesc(output);
     // check the following by order of priority to request a routing change if necessary:
     // 1: the strategy enforced audible is active on the output:
     //      use device for strategy enforced audible
@@ -2269,7 +2853,13 @@ audio_devices_t AudioPolicyManagerBase::getDevicesForStream(AudioSystem::stream_
         devices = AUDIO_DEVICE_NONE;
     } else {
         AudioPolicyManagerBase::routing_strategy strategy = getStrategy(stream);
-        devices = getDeviceForStrategy(strategy, true /*fromCache*/);
+        if (!readsQueryState()) {
+            devices = getDeviceForStrategy(strategy, true /*fromCache*/);
+        } else {
+            QueryState state;
+            readQueryState(state);
+            devices = state.mDeviceForStrategy[strategy];
+        }
     }
     return devices;
 }
@@ -2323,32 +2913,99 @@ audio_devices_t AudioPolicyManagerBase::getDeviceForStrategy(routing_strategy st
         return mDeviceForStrategy[strategy];
     }
 
-    switch (strategy) {
+    if (strategy < 0 || strategy >= NUM_STRATEGIES) {
+        ALOGW("getDeviceForStrategy() unknown strategy: %d", strategy);
+        return AUDIO_DEVICE_NONE;
+    }
 
-    case STRATEGY_SONIFICATION_RESPECTFUL:
-        if (isInCall()) {
-            device = getDeviceForStrategy(STRATEGY_SONIFICATION, false /*fromCache*/);
-        } else if (isStreamActiveRemotely(AudioSystem::MUSIC,
+    updateRoutingTable();
+
+    if (strategy == STRATEGY_SONIFICATION_RESPECTFUL && !isInCall()) {
+        // the respectful sonification device depends on recent music activity which is not
+        // part of the routing table key: select between the table entries for sonification
+        // and media.
+        if (isStreamActiveRemotely(AudioSystem::MUSIC,
                 SONIFICATION_RESPECTFUL_AFTER_MUSIC_DELAY)) {
             // while media is playing on a remote device, use the the sonification behavior.
             // Note that we test this usecase before testing if media is playing because
             //   the isStreamActive() method only informs about the activity of a stream, not
             //   if it's for local playback. Note also that we use the same delay between both tests
-            device = getDeviceForStrategy(STRATEGY_SONIFICATION, false /*fromCache*/);
+            device = mRoutingTable[STRATEGY_SONIFICATION];
         } else if (isStreamActive(AudioSystem::MUSIC, SONIFICATION_RESPECTFUL_AFTER_MUSIC_DELAY)) {
             // while media is playing (or has recently played), use the same device
-            device = getDeviceForStrategy(STRATEGY_MEDIA, false /*fromCache*/);
+            device = mRoutingTable[STRATEGY_MEDIA];
         } else {
             // when media is not playing anymore, fall back on the sonification behavior
-            device = getDeviceForStrategy(STRATEGY_SONIFICATION, false /*fromCache*/);
+            device = mRoutingTable[STRATEGY_SONIFICATION];
+        }
+    } else {
+        device = mRoutingTable[strategy];
+    }
+
+    ALOGVV("getDeviceForStrategy() strategy %d, device %x", strategy, device);
+    return device;
+}
+
+void AudioPolicyManagerBase::getRoutingKey(RoutingKey *key)
+{
+    key->mAvailableOutputDevices = mAvailableOutputDevices;
+    key->mPhoneState = mPhoneState;
+    for (int i = 0; i < AudioSystem::NUM_FORCE_USE; i++) {
+        key->mForceUse[i] = mForceUse[i];
+    }
+    // the A2DP output is only looked up when an A2DP device is connected: the A2DP
+    // conditions in computeDeviceForStrategy() have no effect otherwise.
+    key->mA2dpUsable = mHasA2dp && !mA2dpSuspended &&
+            (mAvailableOutputDevices & AUDIO_DEVICE_OUT_ALL_A2DP) &&
+            (getA2dpOutput() != 0);
+}
+
+bool AudioPolicyManagerBase::RoutingKey::operator==(const RoutingKey& other) const
+{
+    if (mAvailableOutputDevices != other.mAvailableOutputDevices ||
+            mPhoneState != other.mPhoneState ||
+            mA2dpUsable != other.mA2dpUsable) {
+        return false;
+    }
+    for (int i = 0; i < AudioSystem::NUM_FORCE_USE; i++) {
+        if (mForceUse[i] != other.mForceUse[i]) {
+            return false;
         }
+    }
+    return true;
+}
 
+void AudioPolicyManagerBase::updateRoutingTable()
+{
+    RoutingKey key;
+    getRoutingKey(&key);
+    if (mRoutingTableValid && key == mRoutingKey) {
+        return;
+    }
+    mRoutingKey = key;
+    mRoutingTableValid = true;
+    for (int i = 0; i < NUM_STRATEGIES; i++) {
+        mRoutingTable[i] = computeDeviceForStrategy((routing_strategy)i);
+    }
+    ALOGV("updateRoutingTable() devices %08x phone state %d a2dp %d",
+          key.mAvailableOutputDevices, key.mPhoneState, key.mA2dpUsable);
+}
+
+audio_devices_t AudioPolicyManagerBase::computeDeviceForStrategy(routing_strategy strategy)
+{
+    uint32_t device = AUDIO_DEVICE_NONE;
+
+    switch (strategy) {
+
+    case STRATEGY_SONIFICATION_RESPECTFUL:
+        // only used while in call, see getDeviceForStrategy()
+        device = computeDeviceForStrategy(STRATEGY_SONIFICATION);
         break;
 
     case STRATEGY_DTMF:
         if (!isInCall()) {
             // when off call, DTMF strategy follows the same rules as MEDIA strategy
-            device = getDeviceForStrategy(STRATEGY_MEDIA, false /*fromCache*/);
+            device = computeDeviceForStrategy(STRATEGY_MEDIA);
             break;
         }
         // when in call, DTMF and PHONE strategies follow the same rules
@@ -2374,7 +3031,7 @@ audio_devices_t AudioPolicyManagerBase::getDeviceForStrategy(routing_strategy st
             // when not in a phone call, phone strategy should route STREAM_VOICE_CALL to A2DP
             if (mHasA2dp && !isInCall() &&
                     (mForceUse[AudioSystem::FOR_MEDIA] != AudioSystem::FORCE_NO_BT_A2DP) &&
-                    (getA2dpOutput() != 0) && !mA2dpSuspended) {
+                    mRoutingKey.mA2dpUsable) {
                 device = mAvailableOutputDevices & AUDIO_DEVICE_OUT_BLUETOOTH_A2DP;
                 if (device) break;
                 device = mAvailableOutputDevices & AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES;
@@ -2409,7 +3066,7 @@ audio_devices_t AudioPolicyManagerBase::getDeviceForStrategy(routing_strategy st
             // A2DP speaker when forcing to speaker output
             if (mHasA2dp && !isInCall() &&
                     (mForceUse[AudioSystem::FOR_MEDIA] != AudioSystem::FORCE_NO_BT_A2DP) &&
-                    (getA2dpOutput() != 0) && !mA2dpSuspended) {
+                    mRoutingKey.mA2dpUsable) {
                 device = mAvailableOutputDevices & AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER;
                 if (device) break;
             }
@@ -2440,7 +3097,7 @@ audio_devices_t AudioPolicyManagerBase::getDeviceForStrategy(routing_strategy st
         // If incall, just select the STRATEGY_PHONE device: The rest of the behavior is handled by
         // handleIncallSonification().
         if (isInCall()) {
-            device = getDeviceForStrategy(STRATEGY_PHONE, false /*fromCache*/);
+            device = computeDeviceForStrategy(STRATEGY_PHONE);
             break;
         }
         // FALL THROUGH
@@ -2469,7 +3126,7 @@ audio_devices_t AudioPolicyManagerBase::getDeviceForStrategy(routing_strategy st
         }
         if ((device2 == AUDIO_DEVICE_NONE) &&
                 mHasA2dp && (mForceUse[AudioSystem::FOR_MEDIA] != AudioSystem::FORCE_NO_BT_A2DP) &&
-                (getA2dpOutput() != 0) && !mA2dpSuspended) {
+                mRoutingKey.mA2dpUsable) {
             device2 = mAvailableOutputDevices & AUDIO_DEVICE_OUT_BLUETOOTH_A2DP;
             if (device2 == AUDIO_DEVICE_NONE) {
                 device2 = mAvailableOutputDevices & AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES;
@@ -2516,11 +3173,11 @@ audio_devices_t AudioPolicyManagerBase::getDeviceForStrategy(routing_strategy st
         } break;
 
     default:
-        ALOGW("getDeviceForStrategy() unknown strategy: %d", strategy);
+        ALOGW("computeDeviceForStrategy() unknown strategy: %d", strategy);
         break;
     }
 
-    ALOGVV("getDeviceForStrategy() strategy %d, device %x", strategy, device);
+    ALOGVV("computeDeviceForStrategy() strategy %d, device %x", strategy, device);
     return device;
 }
 
@@ -2529,7 +3186,7 @@ void AudioPolicyManagerBase::updateDevicesAndOutputs()
     for (int i = 0; i < NUM_STRATEGIES; i++) {
         mDeviceForStrategy[i] = getDeviceForStrategy((routing_strategy)i, false /*fromCache*/);
     }
-    mPreviousOutputs = mOutputs;
+    snapshotOutputs();
 }
 
 uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor *outputDesc,
@@ -2599,6 +3256,8 @@ uint32_t AudioPolicyManagerBase::checkDeviceMuteStrategies(AudioOutputDescriptor
     // wait for the PCM output buffers to empty before proceeding with the rest of the command
     if (muteWaitMs > delayMs) {
         muteWaitMs -= delayMs;
+        // mute commands must reach the audio HAL before we start waiting
+        flushRoutingCommands();
         usleep(muteWaitMs * 1000);
         return muteWaitMs;
     }
@@ -2611,8 +3270,7 @@ uint32_t AudioPolicyManagerBase::setOutputDevice(audio_io_handle_t output,
                                              int delayMs)
 {
     ALOGV("setOutputDevice() output %d device %04x delayMs %d", output, device, delayMs);
-    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(output);
-    AudioParameter param;
+    AudioOutputDescriptor *outputDesc = getOutputDesc(output);
     uint32_t muteWaitMs;
 
     if (outputDesc->isDuplicated()) {
@@ -2650,8 +3308,7 @@ uint32_t AudioPolicyManagerBase::setOutputDevice(audio_io_handle_t output,
 
     ALOGV("setOutputDevice() changing device");
     // do the routing
-    param.addInt(String8(AudioParameter::keyRouting), (int)device);
-    mpClientInterface->setParameters(output, param.toString(), delayMs);
+    sendRoutingCommand(output, device, delayMs);
 
     // update stream volumes according to new device
     applyStreamVolumes(output, device, delayMs);
@@ -2659,6 +3316,115 @@ uint32_t AudioPolicyManagerBase::setOutputDevice(audio_io_handle_t output,
     return muteWaitMs;
 }
 
+void AudioPolicyManagerBase::beginRoutingTransaction()
+{
+    mRoutingTransactionDepth++;
+}
+
+void AudioPolicyManagerBase::commitRoutingTransaction()
+{
+    if (mRoutingTransactionDepth == 0) {
+        ALOGW("commitRoutingTransaction() no open transaction");
+        return;
+    }
+    if (--mRoutingTransactionDepth == 0) {
+        flushRoutingCommands();
+    }
+}
+
+void AudioPolicyManagerBase::flushRoutingCommands()
+{
+    if (mRoutingCommands.isEmpty()) {
+        return;
+    }
+    ALOGV("flushRoutingCommands() sending %d commands", mRoutingCommands.size());
+
+    // detach the queue first: the client may call back into the policy manager
+    Vector <RoutingCommand> commands = mRoutingCommands;
+    mRoutingCommands.clear();
+
+    // commands are sent in the order they were issued, as they would have been without a
+    // transaction: the audio policy service command thread lets a volume command override
+    // pending ones for the same stream, so delays must not be reordered.
+    for (size_t i = 0; i < commands.size(); i++) {
+        const RoutingCommand& command = commands[i];
+        if (command.mStream < 0) {
+            AudioParameter param;
+            param.addInt(String8(AudioParameter::keyRouting), (int)command.mDevice);
+            mpClientInterface->setParameters(command.mOutput, param.toString(), command.mDelayMs);
+            mRoutingCommandsSent++;
+        } else {
+            mpClientInterface->setStreamVolume((AudioSystem::stream_type)command.mStream,
+                                               command.mVolume, command.mOutput, command.mDelayMs);
+            mVolumeCommandsSent++;
+        }
+    }
+}
+
+void AudioPolicyManagerBase::discardRoutingCommands(audio_io_handle_t output)
+{
+    for (size_t i = mRoutingCommands.size(); i > 0; i--) {
+        if (mRoutingCommands[i - 1].mOutput == output) {
+            mRoutingCommands.removeAt(i - 1);
+        }
+    }
+}
+
+void AudioPolicyManagerBase::sendRoutingCommand(audio_io_handle_t output,
+                                                audio_devices_t device,
+                                                int delayMs)
+{
+    if (mRoutingTransactionDepth == 0) {
+        AudioParameter param;
+        param.addInt(String8(AudioParameter::keyRouting), (int)device);
+        mpClientInterface->setParameters(output, param.toString(), delayMs);
+        mRoutingCommandsSent++;
+        return;
+    }
+    RoutingCommand command;
+    command.mOutput = output;
+    command.mStream = -1;
+    command.mDevice = device;
+    command.mVolume = 0;
+    command.mDelayMs = delayMs;
+    queueRoutingCommand(command);
+}
+
+void AudioPolicyManagerBase::sendVolumeCommand(audio_io_handle_t output,
+                                               int stream,
+                                               float volume,
+                                               int delayMs)
+{
+    if (mRoutingTransactionDepth == 0) {
+        mpClientInterface->setStreamVolume((AudioSystem::stream_type)stream, volume, output, delayMs);
+        mVolumeCommandsSent++;
+        return;
+    }
+    RoutingCommand command;
+    command.mOutput = output;
+    command.mStream = stream;
+    command.mDevice = AUDIO_DEVICE_NONE;
+    command.mVolume = volume;
+    command.mDelayMs = delayMs;
+    queueRoutingCommand(command);
+}
+
+void AudioPolicyManagerBase::queueRoutingCommand(const RoutingCommand& command)
+{
+    // a later command for the same output, stream and delay supersedes the pending one and
+    // takes its place in the queue
+    for (size_t i = 0; i < mRoutingCommands.size(); i++) {
+        const RoutingCommand& pending = mRoutingCommands[i];
+        if (pending.mOutput == command.mOutput && pending.mStream == command.mStream &&
+                pending.mDelayMs == command.mDelayMs) {
+            mRoutingCommands.editItemAt(i) = command;
+            mCommandsCoalesced++;
+            return;
+        }
+    }
+    mRoutingCommands.add(command);
+}
+
 AudioPolicyManagerBase::IOProfile *AudioPolicyManagerBase::getInputProfile(audio_devices_t device,
                                                    uint32_t samplingRate,
                                                    uint32_t format,
@@ -2666,22 +3432,19 @@ AudioPolicyManagerBase::IOProfile *AudioPolicyManagerBase::getInputProfile(audio
 {
     // Choose an input profile based on the requested capture parameters: select the first available
     // profile supporting all requested parameters.
+    updateProfileIndex();
+    return mInputProfileIndex.find(device, samplingRate, format, channelMask,
+                                   (audio_output_flags_t)0, AUDIO_DEVICE_NONE);
+}
 
-    for (size_t i = 0; i < mHwModules.size(); i++)
-    {
-        if (mHwModules[i]->mHandle == 0) {
-            continue;
-        }
-        for (size_t j = 0; j < mHwModules[i]->mInputProfiles.size(); j++)
-        {
-            IOProfile *profile = mHwModules[i]->mInputProfiles[j];
-            if (profile->isCompatibleProfile(device, samplingRate, format,
-                                             channelMask,(audio_output_flags_t)0)) {
-                return profile;
-            }
-        }
+void AudioPolicyManagerBase::updateProfileIndex()
+{
+    if (mProfileIndexValid) {
+        return;
     }
-    return NULL;
+    mOutputProfileIndex.build(mHwModules, true /*output*/);
+    mInputProfileIndex.build(mHwModules, false /*output*/);
+    mProfileIndexValid = true;
 }
 
 audio_devices_t AudioPolicyManagerBase::getDeviceForInputSource(int inputSource)
@@ -2813,27 +3576,37 @@ float AudioPolicyManagerBase::volIndexToAmpl(audio_devices_t device, const Strea
         int indexInUi)
 {
     device_category deviceCategory = getDeviceCategory(device);
-    const VolumeCurvePoint *curve = streamDesc.mVolumeCurve[deviceCategory];
+    const Vector <float>& table = streamDesc.mVolumeTable[deviceCategory];
+
+    int tableIndex = indexInUi - streamDesc.mIndexMin;
+    if (tableIndex >= 0 && (size_t)tableIndex < table.size() &&
+            streamDesc.isVolumeTableValid(deviceCategory)) {
+        return table[tableIndex];
+    }
+    return computeVolIndexToAmpl(streamDesc.mVolumeCurve[deviceCategory],
+                                 streamDesc.mVolumeCurveSize[deviceCategory],
+                                 streamDesc.mIndexMin, streamDesc.mIndexMax, indexInUi);
+}
 
+float AudioPolicyManagerBase::computeVolIndexToAmpl(const VolumeCurvePoint *curve,
+        size_t curveSize, int indexMin, int indexMax, int indexInUi)
+{
     // the volume index in the UI is relative to the min and max volume indices for this stream type
-    int nbSteps = 1 + curve[VOLMAX].mIndex -
-            curve[VOLMIN].mIndex;
-    int volIdx = (nbSteps * (indexInUi - streamDesc.mIndexMin)) /
-            (streamDesc.mIndexMax - streamDesc.mIndexMin);
+    int nbSteps = 1 + curve[curveSize - 1].mIndex -
+            curve[0].mIndex;
+    int volIdx = (nbSteps * (indexInUi - indexMin)) /
+            (indexMax - indexMin);
 
     // find what part of the curve this index volume belongs to, or if it's out of bounds
-    int segment = 0;
-    if (volIdx < curve[VOLMIN].mIndex) {         // out of bounds
+    if (volIdx < curve[0].mIndex) {                     // out of bounds
         return 0.0f;
-    } else if (volIdx < curve[VOLKNEE1].mIndex) {
-        segment = 0;
-    } else if (volIdx < curve[VOLKNEE2].mIndex) {
-        segment = 1;
-    } else if (volIdx <= curve[VOLMAX].mIndex) {
-        segment = 2;
-    } else {                                                               // out of bounds
+    } else if (volIdx > curve[curveSize - 1].mIndex) {  // out of bounds
         return 1.0f;
     }
+    size_t segment = 0;
+    while (segment < curveSize - 2 && volIdx >= curve[segment + 1].mIndex) {
+        segment++;
+    }
 
     // linear interpolation in the attenuation table in dB
     float decibels = curve[segment].mDBAttenuation +
@@ -2969,23 +3742,42 @@ const AudioPolicyManagerBase::VolumeCurvePoint
 void AudioPolicyManagerBase::initializeVolumeCurves()
 {
     for (int i = 0; i < AUDIO_STREAM_CNT; i++) {
-        for (int j = 0; j < DEVICE_CATEGORY_CNT; j++) {
-            mStreams[i].mVolumeCurve[j] =
-                    sVolumeProfiles[i][j];
-        }
+        setStreamVolumeCurves(i, i);
     }
+}
 
+const AudioPolicyManagerBase::VolumeCurvePoint *AudioPolicyManagerBase::getVolumeCurve(
+        int stream, device_category category, size_t *size) const
+{
+    const Vector <VolumeCurvePoint>& curve = mConfigVolumeCurves[stream][category];
+    if (!curve.isEmpty()) {
+        *size = curve.size();
+        return curve.array();
+    }
+    *size = VOLCNT;
     // Check availability of DRC on speaker path: if available, override some of the speaker curves
-    if (mSpeakerDrcEnabled) {
-        mStreams[AUDIO_STREAM_SYSTEM].mVolumeCurve[DEVICE_CATEGORY_SPEAKER] =
-                sDefaultSystemVolumeCurveDrc;
-        mStreams[AUDIO_STREAM_RING].mVolumeCurve[DEVICE_CATEGORY_SPEAKER] =
-                sSpeakerSonificationVolumeCurveDrc;
-        mStreams[AUDIO_STREAM_ALARM].mVolumeCurve[DEVICE_CATEGORY_SPEAKER] =
-                sSpeakerSonificationVolumeCurveDrc;
-        mStreams[AUDIO_STREAM_NOTIFICATION].mVolumeCurve[DEVICE_CATEGORY_SPEAKER] =
-                sSpeakerSonificationVolumeCurveDrc;
+    if (mSpeakerDrcEnabled && category == DEVICE_CATEGORY_SPEAKER) {
+        switch (stream) {
+        case AUDIO_STREAM_SYSTEM:
+            return sDefaultSystemVolumeCurveDrc;
+        case AUDIO_STREAM_RING:
+        case AUDIO_STREAM_ALARM:
+        case AUDIO_STREAM_NOTIFICATION:
+            return sSpeakerSonificationVolumeCurveDrc;
+        default:
+            break;
+        }
+    }
+    return sVolumeProfiles[stream][category];
+}
+
+void AudioPolicyManagerBase::setStreamVolumeCurves(int stream, int curveStream)
+{
+    for (int j = 0; j < DEVICE_CATEGORY_CNT; j++) {
+        mStreams[stream].mVolumeCurve[j] = getVolumeCurve(curveStream, (device_category)j,
+                                                          &mStreams[stream].mVolumeCurveSize[j]);
     }
+    mStreams[stream].updateVolumeTables();
 }
 
 float AudioPolicyManagerBase::computeVolume(int stream,
@@ -2994,7 +3786,7 @@ float AudioPolicyManagerBase::computeVolume(int stream,
                                             audio_devices_t device)
 {
     float volume = 1.0;
-    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(output);
+    AudioOutputDescriptor *outputDesc = getOutputDesc(output);
     StreamDescriptor &streamDesc = mStreams[stream];
 
     if (device == AUDIO_DEVICE_NONE) {
@@ -3061,9 +3853,9 @@ status_t AudioPolicyManagerBase::checkAndSetVolume(int stream,
 {
 
     // do not change actual stream volume if the stream is muted
-    if (mOutputs.valueFor(output)->mMuteCount[stream] != 0) {
+    if (getOutputDesc(output)->mMuteCount[stream] != 0) {
         ALOGVV("checkAndSetVolume() stream %d muted count %d",
-              stream, mOutputs.valueFor(output)->mMuteCount[stream]);
+              stream, getOutputDesc(output)->mMuteCount[stream]);
         return NO_ERROR;
     }
 
@@ -3079,16 +3871,16 @@ status_t AudioPolicyManagerBase::checkAndSetVolume(int stream,
     // We actually change the volume if:
     // - the float value returned by computeVolume() changed
     // - the force flag is set
-    if (volume != mOutputs.valueFor(output)->mCurVolume[stream] ||
+    if (volume != getOutputDesc(output)->mCurVolume[stream] ||
             force) {
-        mOutputs.valueFor(output)->mCurVolume[stream] = volume;
+        getOutputDesc(output)->mCurVolume[stream] = volume;
         ALOGVV("checkAndSetVolume() for output %d stream %d, volume %f, delay %d", output, stream, volume, delayMs);
         // Force VOICE_CALL to track BLUETOOTH_SCO stream volume when bluetooth audio is
         // enabled
         if (stream == AudioSystem::BLUETOOTH_SCO) {
-            mpClientInterface->setStreamVolume(AudioSystem::VOICE_CALL, volume, output, delayMs);
+            sendVolumeCommand(output, AudioSystem::VOICE_CALL, volume, delayMs);
         }
-        mpClientInterface->setStreamVolume((AudioSystem::stream_type)stream, volume, output, delayMs);
+        sendVolumeCommand(output, stream, volume, delayMs);
     }
 
     if (stream == AudioSystem::VOICE_CALL ||
@@ -3148,7 +3940,7 @@ void AudioPolicyManagerBase::setStreamMute(int stream,
                                            audio_devices_t device)
 {
     StreamDescriptor &streamDesc = mStreams[stream];
-    AudioOutputDescriptor *outputDesc = mOutputs.valueFor(output);
+    AudioOutputDescriptor *outputDesc = getOutputDesc(output);
     if (device == AUDIO_DEVICE_NONE) {
         device = outputDesc->device();
     }
@@ -3192,7 +3984,7 @@ void AudioPolicyManagerBase::handleIncallSonification(int stream, bool starting,
     const routing_strategy stream_strategy = getStrategy((AudioSystem::stream_type)stream);
     if ((stream_strategy == STRATEGY_SONIFICATION) ||
             ((stream_strategy == STRATEGY_SONIFICATION_RESPECTFUL))) {
-        AudioOutputDescriptor *outputDesc = mOutputs.valueFor(mPrimaryOutput);
+        AudioOutputDescriptor *outputDesc = getOutputDesc(mPrimaryOutput);
         ALOGV("handleIncallSonification() stream %d starting %d device %x stateChange %d",
                 stream, starting, outputDesc->mDevice, stateChange);
         if (outputDesc->mRefCount[stream]) {
@@ -3251,7 +4043,9 @@ AudioPolicyManagerBase::AudioOutputDescriptor::AudioOutputDescriptor(
     : mId(0), mSamplingRate(0), mFormat((audio_format_t)0),
       mChannelMask((audio_channel_mask_t)0), mLatency(0),
     mFlags((audio_output_flags_t)0), mDevice(AUDIO_DEVICE_NONE),
-    mOutput1(0), mOutput2(0), mProfile(profile), mDirectOpenCount(0)
+    mActiveRefCount(0), mLastStopTime(0),
+    mOutput1(0), mOutput2(0), mProfile(profile), mDirectOpenCount(0),
+    mHasOffloadInfo(false)
 {
     // clear usage count for all stream types
     for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
@@ -3262,6 +4056,8 @@ AudioPolicyManagerBase::AudioOutputDescriptor::AudioOutputDescriptor(
     }
     for (int i = 0; i < NUM_STRATEGIES; i++) {
         mStrategyMutedByDevice[i] = false;
+        mStrategyRefCount[i] = 0;
+        mStrategyStopTime[i] = 0;
     }
     if (profile != NULL) {
         mSamplingRate = profile->mSamplingRates[0];
@@ -3308,15 +4104,28 @@ void AudioPolicyManagerBase::AudioOutputDescriptor::changeRefCount(AudioSystem::
         mOutput1->changeRefCount(stream, delta);
         mOutput2->changeRefCount(stream, delta);
     }
+    routing_strategy strategy = getStrategy(stream);
     if ((delta + (int)mRefCount[stream]) < 0) {
         ALOGW("changeRefCount() invalid delta %d for stream %d, refCount %d", delta, stream, mRefCount[stream]);
+        mStrategyRefCount[strategy] -= mRefCount[stream];
+        mActiveRefCount -= mRefCount[stream];
         mRefCount[stream] = 0;
         return;
     }
     mRefCount[stream] += delta;
+    mStrategyRefCount[strategy] += delta;
+    mActiveRefCount += delta;
     ALOGV("changeRefCount() stream %d, count %d", stream, mRefCount[stream]);
 }
 
+void AudioPolicyManagerBase::AudioOutputDescriptor::setStopTime(AudioSystem::stream_type stream,
+                                                                nsecs_t sysTime)
+{
+    mStopTime[stream] = sysTime;
+    mStrategyStopTime[getStrategy(stream)] = sysTime;
+    mLastStopTime = sysTime;
+}
+
 audio_devices_t AudioPolicyManagerBase::AudioOutputDescriptor::supportedDevices()
 {
     if (isDuplicated()) {
@@ -3335,15 +4144,26 @@ bool AudioPolicyManagerBase::AudioOutputDescriptor::isStrategyActive(routing_str
                                                                        uint32_t inPastMs,
                                                                        nsecs_t sysTime) const
 {
-    if ((sysTime == 0) && (inPastMs != 0)) {
+    uint32_t refCount;
+    nsecs_t stopTime;
+    if (strategy == NUM_STRATEGIES) {
+        refCount = mActiveRefCount;
+        stopTime = mLastStopTime;
+    } else {
+        refCount = mStrategyRefCount[strategy];
+        stopTime = mStrategyStopTime[strategy];
+    }
+    if (refCount != 0) {
+        return true;
+    }
+    if (inPastMs == 0) {
+        return false;
+    }
+    if (sysTime == 0) {
         sysTime = systemTime();
     }
-    for (int i = 0; i < AudioSystem::NUM_STREAM_TYPES; i++) {
-        if (((getStrategy((AudioSystem::stream_type)i) == strategy) ||
-                (NUM_STRATEGIES == strategy)) &&
-                isStreamActive((AudioSystem::stream_type)i, inPastMs, sysTime)) {
-            return true;
-        }
+    if (ns2ms(sysTime - stopTime) < inPastMs) {
+        return true;
     }
     return false;
 }
@@ -3427,22 +4247,117 @@ status_t AudioPolicyManagerBase::AudioInputDescriptor::dump(int fd)
     return NO_ERROR;
 }
 
+// --- LatencyHistogram class implementation
+
+AudioPolicyManagerBase::LatencyHistogram::LatencyHistogram()
+    : mCount(0), mTotal(0), mMax(0)
+{
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        mBuckets[i] = 0;
+    }
+}
+
+void AudioPolicyManagerBase::LatencyHistogram::add(nsecs_t duration)
+{
+    uint32_t us = (uint32_t)(duration / 1000);
+    int bucket = 0;
+    while ((us >>= 1) != 0 && bucket < NUM_BUCKETS - 1) {
+        bucket++;
+    }
+    mBuckets[bucket]++;
+    mCount++;
+    mTotal += duration;
+    if (duration > mMax) {
+        mMax = duration;
+    }
+}
+
+void AudioPolicyManagerBase::LatencyHistogram::dump(int fd, const char *name)
+{
+    const size_t SIZE = 256;
+    char buffer[SIZE];
+    String8 result;
+
+    snprintf(buffer, SIZE, " %s: count %u avg %lld us max %lld us\n", name, mCount,
+             mCount != 0 ? (long long)(mTotal / mCount / 1000) : 0LL, (long long)(mMax / 1000));
+    result.append(buffer);
+    for (int i = 0; i < NUM_BUCKETS; i++) {
+        if (mBuckets[i] == 0) {
+            continue;
+        }
+        if (i == NUM_BUCKETS - 1) {
+            snprintf(buffer, SIZE, "  >= %u us: %u\n", 1u << i, mBuckets[i]);
+        } else {
+            snprintf(buffer, SIZE, "  < %u us: %u\n", 2u << i, mBuckets[i]);
+        }
+        result.append(buffer);
+    }
+    write(fd, result.string(), result.size());
+}
+
 // --- StreamDescriptor class implementation
 
 AudioPolicyManagerBase::StreamDescriptor::StreamDescriptor()
-    :   mIndexMin(0), mIndexMax(1), mCanBeMuted(true)
+    :   mIndexMin(0), mIndexMax(1), mIndexCurDevices(AUDIO_DEVICE_NONE), mCanBeMuted(true),
+        mVolumeTableIndexMin(0), mVolumeTableIndexMax(0)
 {
-    mIndexCur.add(AUDIO_DEVICE_OUT_DEFAULT, 0);
+    memset(mIndexCur, 0, sizeof(mIndexCur));
+    setVolumeIndex(AUDIO_DEVICE_OUT_DEFAULT, 0);
+    for (int i = 0; i < DEVICE_CATEGORY_CNT; i++) {
+        mVolumeCurve[i] = NULL;
+        mVolumeCurveSize[i] = 0;
+        mVolumeTableCurve[i] = NULL;
+    }
 }
 
 int AudioPolicyManagerBase::StreamDescriptor::getVolumeIndex(audio_devices_t device)
 {
     device = AudioPolicyManagerBase::getDeviceForVolume(device);
     // there is always a valid entry for AUDIO_DEVICE_OUT_DEFAULT
-    if (mIndexCur.indexOfKey(device) < 0) {
+    if ((device == AUDIO_DEVICE_NONE) || (device & (device - 1)) ||
+            !(mIndexCurDevices & device)) {
         device = AUDIO_DEVICE_OUT_DEFAULT;
     }
-    return mIndexCur.valueFor(device);
+    return mIndexCur[__builtin_ctz(device)];
+}
+
+void AudioPolicyManagerBase::StreamDescriptor::setVolumeIndex(audio_devices_t device, int index)
+{
+    if ((device == AUDIO_DEVICE_NONE) || (device & (device - 1))) {
+        ALOGW("setVolumeIndex() invalid device %08x", device);
+        return;
+    }
+    mIndexCur[__builtin_ctz(device)] = index;
+    mIndexCurDevices = (audio_devices_t)(mIndexCurDevices | device);
+}
+
+void AudioPolicyManagerBase::StreamDescriptor::clearVolumeIndexes()
+{
+    mIndexCurDevices = (audio_devices_t)(mIndexCurDevices & AUDIO_DEVICE_OUT_DEFAULT);
+}
+
+void AudioPolicyManagerBase::StreamDescriptor::updateVolumeTables()
+{
+    for (int i = 0; i < DEVICE_CATEGORY_CNT; i++) {
+        mVolumeTable[i].clear();
+        mVolumeTableCurve[i] = mVolumeCurve[i];
+        if (mVolumeCurve[i] == NULL) {
+            continue;
+        }
+        mVolumeTable[i].setCapacity(mIndexMax - mIndexMin + 1);
+        for (int index = mIndexMin; index <= mIndexMax; index++) {
+            mVolumeTable[i].add(computeVolIndexToAmpl(mVolumeCurve[i], mVolumeCurveSize[i],
+                                                      mIndexMin, mIndexMax, index));
+        }
+    }
+    mVolumeTableIndexMin = mIndexMin;
+    mVolumeTableIndexMax = mIndexMax;
+}
+
+bool AudioPolicyManagerBase::StreamDescriptor::isVolumeTableValid(int category) const
+{
+    return mVolumeTableCurve[category] == mVolumeCurve[category] &&
+            mVolumeTableIndexMin == mIndexMin && mVolumeTableIndexMax == mIndexMax;
 }
 
 void AudioPolicyManagerBase::StreamDescriptor::dump(int fd)
@@ -3454,11 +4369,11 @@ void AudioPolicyManagerBase::StreamDescriptor::dump(int fd)
     snprintf(buffer, SIZE, "%s         %02d         %02d         ",
              mCanBeMuted ? "true " : "false", mIndexMin, mIndexMax);
     result.append(buffer);
-    for (size_t i = 0; i < mIndexCur.size(); i++) {
-        snprintf(buffer, SIZE, "%04x : %02d, ",
-                 mIndexCur.keyAt(i),
-                 mIndexCur.valueAt(i));
-        result.append(buffer);
+    for (int i = 0; i < 32; i++) {
+        if (mIndexCurDevices & (1u << i)) {
+            snprintf(buffer, SIZE, "%04x : %02d, ", 1u << i, mIndexCur[i]);
+            result.append(buffer);
+        }
     }
     result.append("\n");
 
@@ -3488,6 +4403,12 @@ status_t AudioPolicyManagerBase::EffectDescriptor::dump(int fd)
     return NO_ERROR;
 }
 
+bool AudioPolicyManagerBase::EffectDescriptor::preventsOffload() const
+{
+    return (mStrategy == STRATEGY_MEDIA) &&
+            ((mDesc.flags & EFFECT_FLAG_OFFLOAD_SUPPORTED) == 0);
+}
+
 // --- IOProfile class implementation
 
 AudioPolicyManagerBase::HwModule::HwModule(const char *name)
@@ -3632,6 +4553,115 @@ void AudioPolicyManagerBase::IOProfile::dump(int fd)
     write(fd, result.string(), result.size());
 }
 
+// --- ProfileIndex class implementation
+
+AudioPolicyManagerBase::ProfileIndex::ProfileIndex()
+    : mIndexed(false), mSamplingRates(0), mFormats(0), mChannelMasks(0)
+{
+    memset(mDevices, 0, sizeof(mDevices));
+}
+
+void AudioPolicyManagerBase::ProfileIndex::build(const Vector <HwModule *>& hwModules,
+                                                 bool output)
+{
+    mProfiles.clear();
+    mSamplingRates.clear();
+    mFormats.clear();
+    mChannelMasks.clear();
+    memset(mDevices, 0, sizeof(mDevices));
+
+    for (size_t i = 0; i < hwModules.size(); i++) {
+        const Vector <IOProfile *>& profiles = output ? hwModules[i]->mOutputProfiles :
+                                                        hwModules[i]->mInputProfiles;
+        for (size_t j = 0; j < profiles.size(); j++) {
+            mProfiles.add(profiles[j]);
+        }
+    }
+
+    mIndexed = mProfiles.size() <= MAX_PROFILES;
+    if (!mIndexed) {
+        ALOGW("ProfileIndex::build() %d profiles, using linear search", mProfiles.size());
+        return;
+    }
+
+    for (size_t i = 0; i < mProfiles.size(); i++) {
+        const IOProfile *profile = mProfiles[i];
+        uint64_t bit = 1ULL << i;
+
+        for (size_t j = 0; j < profile->mSamplingRates.size(); j++) {
+            uint32_t rate = profile->mSamplingRates[j];
+            mSamplingRates.add(rate, mSamplingRates.valueFor(rate) | bit);
+        }
+        for (size_t j = 0; j < profile->mFormats.size(); j++) {
+            uint32_t format = profile->mFormats[j];
+            mFormats.add(format, mFormats.valueFor(format) | bit);
+        }
+        for (size_t j = 0; j < profile->mChannelMasks.size(); j++) {
+            uint32_t channelMask = profile->mChannelMasks[j];
+            mChannelMasks.add(channelMask, mChannelMasks.valueFor(channelMask) | bit);
+        }
+        for (int d = 0; d < 32; d++) {
+            if (profile->mSupportedDevices & (1u << d)) {
+                mDevices[d] |= bit;
+            }
+        }
+    }
+}
+
+AudioPolicyManagerBase::IOProfile *AudioPolicyManagerBase::ProfileIndex::find(
+                                                               audio_devices_t device,
+                                                               uint32_t samplingRate,
+                                                               uint32_t format,
+                                                               uint32_t channelMask,
+                                                               audio_output_flags_t flags,
+                                                               audio_devices_t availableDevices) const
+{
+    if (!mIndexed) {
+        for (size_t i = 0; i < mProfiles.size(); i++) {
+            IOProfile *profile = mProfiles[i];
+            if (profile->mModule->mHandle != 0 &&
+                    profile->isCompatibleProfile(device, samplingRate, format,
+                                                 channelMask, flags) &&
+                    (availableDevices == AUDIO_DEVICE_NONE ||
+                            (availableDevices & profile->mSupportedDevices))) {
+                return profile;
+            }
+        }
+        return NULL;
+    }
+
+    if (samplingRate == 0 || format == 0 || channelMask == 0) {
+        return NULL;
+    }
+
+    uint64_t candidates = mSamplingRates.valueFor(samplingRate) &
+                          mFormats.valueFor(format) &
+                          mChannelMasks.valueFor(channelMask);
+    for (int d = 0; d < 32 && candidates != 0; d++) {
+        if (device & (1u << d)) {
+            candidates &= mDevices[d];
+        }
+    }
+
+    // candidate profiles are visited in declaration order
+    while (candidates != 0) {
+        int i = __builtin_ctzll(candidates);
+        candidates &= candidates - 1;
+
+        IOProfile *profile = mProfiles[i];
+        if (profile->mModule->mHandle == 0 ||
+                (profile->mFlags & flags) != flags) {
+            continue;
+        }
+        if (availableDevices != AUDIO_DEVICE_NONE &&
+                !(availableDevices & profile->mSupportedDevices)) {
+            continue;
+        }
+        return profile;
+    }
+    return NULL;
+}
+
 // --- audio_policy.conf file parsing
 
 struct StringToEnum {
@@ -3668,6 +4698,19 @@ const struct StringToEnum sDeviceNameToEnumTable[] = {
     STRING_TO_ENUM(AUDIO_DEVICE_IN_USB_ACCESSORY),
 };
 
+const struct StringToEnum sStreamNameToEnumTable[] = {
+    STRING_TO_ENUM(AUDIO_STREAM_VOICE_CALL),
+    STRING_TO_ENUM(AUDIO_STREAM_SYSTEM),
+    STRING_TO_ENUM(AUDIO_STREAM_RING),
+    STRING_TO_ENUM(AUDIO_STREAM_MUSIC),
+    STRING_TO_ENUM(AUDIO_STREAM_ALARM),
+    STRING_TO_ENUM(AUDIO_STREAM_NOTIFICATION),
+    STRING_TO_ENUM(AUDIO_STREAM_BLUETOOTH_SCO),
+    STRING_TO_ENUM(AUDIO_STREAM_ENFORCED_AUDIBLE),
+    STRING_TO_ENUM(AUDIO_STREAM_DTMF),
+    STRING_TO_ENUM(AUDIO_STREAM_TTS),
+};
+
 const struct StringToEnum sFlagNameToEnumTable[] = {
     STRING_TO_ENUM(AUDIO_OUTPUT_FLAG_DIRECT),
     STRING_TO_ENUM(AUDIO_OUTPUT_FLAG_PRIMARY),
@@ -3762,6 +4805,8 @@ void AudioPolicyManagerBase::loadSamplingRates(char *name, IOProfile *profile)
 {
     char *str = strtok(name, "|");
 
+    mProfileIndexValid = false;
+
     // by convention, "0' in the first entry in mSamplingRates indicates the supported sampling
     // rates should be read from the output stream after it is opened for the first time
     if (str != NULL && strcmp(str, DYNAMIC_VALUE_TAG) == 0) {
@@ -3784,6 +4829,8 @@ void AudioPolicyManagerBase::loadFormats(char *name, IOProfile *profile)
 {
     char *str = strtok(name, "|");
 
+    mProfileIndexValid = false;
+
     // by convention, "0' in the first entry in mFormats indicates the supported formats
     // should be read from the output stream after it is opened for the first time
     if (str != NULL && strcmp(str, DYNAMIC_VALUE_TAG) == 0) {
@@ -3807,6 +4854,8 @@ void AudioPolicyManagerBase::loadInChannels(char *name, IOProfile *profile)
 {
     const char *str = strtok(name, "|");
 
+    mProfileIndexValid = false;
+
     ALOGV("loadInChannels() %s", name);
 
     if (str != NULL && strcmp(str, DYNAMIC_VALUE_TAG) == 0) {
@@ -3832,6 +4881,8 @@ void AudioPolicyManagerBase::loadOutChannels(char *name, IOProfile *profile)
 {
     const char *str = strtok(name, "|");
 
+    mProfileIndexValid = false;
+
     ALOGV("loadOutChannels() %s", name);
 
     // by convention, "0' in the first entry in mChannelMasks indicates the supported channel
@@ -4025,20 +5076,98 @@ void AudioPolicyManagerBase::loadGlobalConfig(cnode *root)
         } else if (strcmp(SPEAKER_DRC_ENABLED_TAG, node->name) == 0) {
             mSpeakerDrcEnabled = stringToBool((char *)node->value);
             ALOGV("loadGlobalConfig() mSpeakerDrcEnabled = %d", mSpeakerDrcEnabled);
+        } else if (strcmp(VOLUMES_TAG, node->name) == 0) {
+            loadVolumeCurves(node);
         }
         node = node->next;
     }
 }
 
+void AudioPolicyManagerBase::loadVolumeCurves(cnode *root)
+{
+    cnode *streamNode = root->first_child;
+    while (streamNode) {
+        // AUDIO_STREAM_VOICE_CALL is 0: stringToEnum() cannot be used
+        int stream = -1;
+        for (size_t i = 0; i < ARRAY_SIZE(sStreamNameToEnumTable); i++) {
+            if (strcmp(sStreamNameToEnumTable[i].name, streamNode->name) == 0) {
+                stream = sStreamNameToEnumTable[i].value;
+                break;
+            }
+        }
+        if (stream < 0) {
+            ALOGW("loadVolumeCurves() unknown stream %s", streamNode->name);
+            streamNode = streamNode->next;
+            continue;
+        }
+        cnode *node = streamNode->first_child;
+        while (node) {
+            device_category category;
+            if (strcmp(VOLUME_CURVE_HEADSET_TAG, node->name) == 0) {
+                category = DEVICE_CATEGORY_HEADSET;
+            } else if (strcmp(VOLUME_CURVE_SPEAKER_TAG, node->name) == 0) {
+                category = DEVICE_CATEGORY_SPEAKER;
+            } else if (strcmp(VOLUME_CURVE_EARPIECE_TAG, node->name) == 0) {
+                category = DEVICE_CATEGORY_EARPIECE;
+            } else {
+                ALOGW("loadVolumeCurves() unknown device category %s", node->name);
+                node = node->next;
+                continue;
+            }
+            Vector <VolumeCurvePoint>& curve = mConfigVolumeCurves[stream][category];
+            if (parseVolumeCurve((char *)node->value, curve) != NO_ERROR) {
+                ALOGW("loadVolumeCurves() invalid curve %s for %s %s",
+                      node->value, streamNode->name, node->name);
+            } else {
+                ALOGV("loadVolumeCurves() %s %s: %d points",
+                      streamNode->name, node->name, curve.size());
+            }
+            node = node->next;
+        }
+        streamNode = streamNode->next;
+    }
+}
+
+status_t AudioPolicyManagerBase::parseVolumeCurve(char *value, Vector <VolumeCurvePoint>& curve)
+{
+    curve.clear();
+    char *point = strtok(value, "|");
+    while (point != NULL) {
+        VolumeCurvePoint p;
+        if (sscanf(point, "%d,%f", &p.mIndex, &p.mDBAttenuation) != 2 ||
+                (!curve.isEmpty() && p.mIndex <= curve[curve.size() - 1].mIndex)) {
+            curve.clear();
+            return BAD_VALUE;
+        }
+        curve.add(p);
+        point = strtok(NULL, "|");
+    }
+    if (curve.size() < 2) {
+        curve.clear();
+        return BAD_VALUE;
+    }
+    return NO_ERROR;
+}
+
 status_t AudioPolicyManagerBase::loadAudioPolicyConfig(const char *path)
 {
     cnode *root;
     char *data;
+    unsigned size;
 
-    data = (char *)load_file(path, NULL);
+    data = (char *)load_file(path, &size);
     if (data == NULL) {
         return -ENODEV;
     }
+
+    uint32_t hash = hashAudioPolicyConfig(data, size);
+    String8 cachePath = getAudioPolicyConfigCachePath(path);
+    if (loadAudioPolicyConfigCache(cachePath.string(), size, hash) == NO_ERROR) {
+        free(data);
+        ALOGI("loadAudioPolicyConfig() loaded %s from cache %s\n", path, cachePath.string());
+        return NO_ERROR;
+    }
+
     root = config_node("", "");
     config_load(root, data);
 
@@ -4051,9 +5180,313 @@ status_t AudioPolicyManagerBase::loadAudioPolicyConfig(const char *path)
 
     ALOGI("loadAudioPolicyConfig() loaded %s\n", path);
 
+    writeAudioPolicyConfigCache(cachePath.string(), size, hash);
+
     return NO_ERROR;
 }
 
+// --- compiled audio_policy.conf cache
+//
+// The cache is a sequence of 32 bit words in native byte order:
+//  - header: magic, version, config file size, config file hash, total number of words
+//  - global configuration: attached output devices, default output device,
+//    attached input devices, CONFIG_CACHE_FLAG_xxx flags, number of HW modules
+//  - for each HW module: name (AUDIO_HARDWARE_MODULE_ID_MAX_LEN bytes), number of outputs,
+//    number of inputs, then for each output and input profile: supported devices, flags,
+//    and the sampling rates, formats and channel masks each preceded by their count.
+//  - number of configured volume curves, then for each curve: stream, device category,
+//    number of points and for each point the index and the attenuation as float bits.
+
+#define CONFIG_CACHE_MAGIC 0x41504343 // "APCC"
+#define CONFIG_CACHE_VERSION 2
+#define CONFIG_CACHE_HEADER_SIZE 5
+#define CONFIG_CACHE_NAME_SIZE (AUDIO_HARDWARE_MODULE_ID_MAX_LEN / sizeof(uint32_t))
+
+#define CONFIG_CACHE_FLAG_SPEAKER_DRC 0x1
+#define CONFIG_CACHE_FLAG_A2DP 0x2
+#define CONFIG_CACHE_FLAG_USB 0x4
+#define CONFIG_CACHE_FLAG_REMOTE_SUBMIX 0x8
+
+// sequential reader over the words of a mapped cache file
+struct ConfigCacheReader {
+    const uint32_t *mData;
+    size_t mSize;
+    size_t mPos;
+
+    bool read(uint32_t *value) {
+        if (mPos >= mSize) {
+            return false;
+        }
+        *value = mData[mPos++];
+        return true;
+    }
+    // reads a count followed by as many values
+    template <typename T> bool readValues(Vector <T>& values) {
+        uint32_t count;
+        if (!read(&count) || count > mSize - mPos) {
+            return false;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            values.add((T)mData[mPos++]);
+        }
+        return true;
+    }
+};
+
+// FNV-1a hash of the configuration file contents
+uint32_t AudioPolicyManagerBase::hashAudioPolicyConfig(const char *data, size_t size)
+{
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ (uint8_t)data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+template <typename T> static void writeConfigCacheValues(Vector <uint32_t>& data,
+                                                         const Vector <T>& values)
+{
+    data.add(values.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        data.add((uint32_t)values[i]);
+    }
+}
+
+String8 AudioPolicyManagerBase::getAudioPolicyConfigCachePath(const char *path)
+{
+    String8 cachePath(AUDIO_POLICY_CONFIG_CACHE_DIR "/");
+    String8 name(path);
+    char *str = name.lockBuffer(name.size());
+    for (char *c = str; *c != 0; c++) {
+        if (*c == '/') {
+            *c = '_';
+        }
+    }
+    name.unlockBuffer();
+    cachePath.append(name);
+    cachePath.append(AUDIO_POLICY_CONFIG_CACHE_SUFFIX);
+    return cachePath;
+}
+
+status_t AudioPolicyManagerBase::loadAudioPolicyConfigCache(const char *cachePath,
+                                                            uint32_t configSize,
+                                                            uint32_t configHash)
+{
+    int fd = open(cachePath, O_RDONLY);
+    if (fd < 0) {
+        return NAME_NOT_FOUND;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)(CONFIG_CACHE_HEADER_SIZE * sizeof(uint32_t))) {
+        close(fd);
+        return BAD_VALUE;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NO_MEMORY;
+    }
+
+    ConfigCacheReader reader;
+    reader.mData = (const uint32_t *)map;
+    reader.mSize = st.st_size / sizeof(uint32_t);
+    reader.mPos = CONFIG_CACHE_HEADER_SIZE;
+
+    status_t status = BAD_VALUE;
+    Vector <HwModule *> hwModules;
+    uint32_t attachedOutputDevices;
+    uint32_t defaultOutputDevice;
+    uint32_t availableInputDevices;
+    uint32_t flags;
+    uint32_t numModules;
+    uint32_t numCurves;
+    Vector <VolumeCurvePoint> curves[AUDIO_STREAM_CNT][DEVICE_CATEGORY_CNT];
+
+    if (reader.mData[0] != CONFIG_CACHE_MAGIC ||
+            reader.mData[1] != CONFIG_CACHE_VERSION ||
+            reader.mData[2] != configSize ||
+            reader.mData[3] != configHash ||
+            reader.mData[4] != reader.mSize) {
+        ALOGV("loadAudioPolicyConfigCache() %s is stale", cachePath);
+        goto exit;
+    }
+    if (!reader.read(&attachedOutputDevices) ||
+            !reader.read(&defaultOutputDevice) ||
+            !reader.read(&availableInputDevices) ||
+            !reader.read(&flags) ||
+            !reader.read(&numModules)) {
+        goto exit;
+    }
+
+    for (uint32_t i = 0; i < numModules; i++) {
+        if (reader.mSize - reader.mPos < CONFIG_CACHE_NAME_SIZE + 2) {
+            goto exit;
+        }
+        char name[AUDIO_HARDWARE_MODULE_ID_MAX_LEN + 1];
+        memcpy(name, reader.mData + reader.mPos, AUDIO_HARDWARE_MODULE_ID_MAX_LEN);
+        name[AUDIO_HARDWARE_MODULE_ID_MAX_LEN] = 0;
+        reader.mPos += CONFIG_CACHE_NAME_SIZE;
+
+        HwModule *module = new HwModule(name);
+        hwModules.add(module);
+
+        uint32_t numProfiles[2]; // outputs, inputs
+        if (!reader.read(&numProfiles[0]) || !reader.read(&numProfiles[1])) {
+            goto exit;
+        }
+        for (int k = 0; k < 2; k++) {
+            Vector <IOProfile *>& profiles = (k == 0) ? module->mOutputProfiles :
+                                                        module->mInputProfiles;
+            for (uint32_t j = 0; j < numProfiles[k]; j++) {
+                IOProfile *profile = new IOProfile(module);
+                profiles.add(profile);
+                uint32_t devices;
+                uint32_t profileFlags;
+                if (!reader.read(&devices) || !reader.read(&profileFlags) ||
+                        !reader.readValues(profile->mSamplingRates) ||
+                        !reader.readValues(profile->mFormats) ||
+                        !reader.readValues(profile->mChannelMasks)) {
+                    goto exit;
+                }
+                profile->mSupportedDevices = (audio_devices_t)devices;
+                profile->mFlags = (audio_output_flags_t)profileFlags;
+            }
+        }
+    }
+    if (!reader.read(&numCurves)) {
+        goto exit;
+    }
+    for (uint32_t i = 0; i < numCurves; i++) {
+        uint32_t stream;
+        uint32_t category;
+        uint32_t numPoints;
+        if (!reader.read(&stream) || !reader.read(&category) || !reader.read(&numPoints) ||
+                stream >= AUDIO_STREAM_CNT || category >= DEVICE_CATEGORY_CNT ||
+                numPoints < 2 || numPoints > (reader.mSize - reader.mPos) / 2) {
+            goto exit;
+        }
+        for (uint32_t j = 0; j < numPoints; j++) {
+            VolumeCurvePoint point;
+            point.mIndex = (int)reader.mData[reader.mPos++];
+            memcpy(&point.mDBAttenuation, &reader.mData[reader.mPos++], sizeof(float));
+            curves[stream][category].add(point);
+        }
+    }
+    if (reader.mPos != reader.mSize) {
+        goto exit;
+    }
+
+    mAttachedOutputDevices = (audio_devices_t)attachedOutputDevices;
+    mDefaultOutputDevice = (audio_devices_t)defaultOutputDevice;
+    mAvailableInputDevices = (audio_devices_t)availableInputDevices;
+    mSpeakerDrcEnabled = (flags & CONFIG_CACHE_FLAG_SPEAKER_DRC) != 0;
+    mHasA2dp = mHasA2dp || (flags & CONFIG_CACHE_FLAG_A2DP);
+    mHasUsb = mHasUsb || (flags & CONFIG_CACHE_FLAG_USB);
+    mHasRemoteSubmix = mHasRemoteSubmix || (flags & CONFIG_CACHE_FLAG_REMOTE_SUBMIX);
+    for (size_t i = 0; i < hwModules.size(); i++) {
+        mHwModules.add(hwModules[i]);
+    }
+    hwModules.clear();
+    for (int i = 0; i < AUDIO_STREAM_CNT; i++) {
+        for (int j = 0; j < DEVICE_CATEGORY_CNT; j++) {
+            mConfigVolumeCurves[i][j] = curves[i][j];
+        }
+    }
+    mProfileIndexValid = false;
+    status = NO_ERROR;
+
+exit:
+    for (size_t i = 0; i < hwModules.size(); i++) {
+        delete hwModules[i];
+    }
+    ALOGW_IF(status != NO_ERROR && reader.mPos != CONFIG_CACHE_HEADER_SIZE,
+             "loadAudioPolicyConfigCache() %s is corrupted", cachePath);
+    munmap(map, st.st_size);
+    return status;
+}
+
+void AudioPolicyManagerBase::writeAudioPolicyConfigCache(const char *cachePath,
+                                                         uint32_t configSize,
+                                                         uint32_t configHash)
+{
+    Vector <uint32_t> data;
+
+    data.add(CONFIG_CACHE_MAGIC);
+    data.add(CONFIG_CACHE_VERSION);
+    data.add(configSize);
+    data.add(configHash);
+    data.add(0); // total size, filled below
+    data.add(mAttachedOutputDevices);
+    data.add(mDefaultOutputDevice);
+    data.add(mAvailableInputDevices);
+    data.add((mSpeakerDrcEnabled ? CONFIG_CACHE_FLAG_SPEAKER_DRC : 0) |
+             (mHasA2dp ? CONFIG_CACHE_FLAG_A2DP : 0) |
+             (mHasUsb ? CONFIG_CACHE_FLAG_USB : 0) |
+             (mHasRemoteSubmix ? CONFIG_CACHE_FLAG_REMOTE_SUBMIX : 0));
+    data.add(mHwModules.size());
+
+    for (size_t i = 0; i < mHwModules.size(); i++) {
+        HwModule *module = mHwModules[i];
+        uint32_t name[CONFIG_CACHE_NAME_SIZE];
+        memset(name, 0, sizeof(name));
+        strncpy((char *)name, module->mName, AUDIO_HARDWARE_MODULE_ID_MAX_LEN);
+        for (size_t j = 0; j < CONFIG_CACHE_NAME_SIZE; j++) {
+            data.add(name[j]);
+        }
+        data.add(module->mOutputProfiles.size());
+        data.add(module->mInputProfiles.size());
+        for (int k = 0; k < 2; k++) {
+            const Vector <IOProfile *>& profiles = (k == 0) ? module->mOutputProfiles :
+                                                              module->mInputProfiles;
+            for (size_t j = 0; j < profiles.size(); j++) {
+                data.add(profiles[j]->mSupportedDevices);
+                data.add(profiles[j]->mFlags);
+                writeConfigCacheValues(data, profiles[j]->mSamplingRates);
+                writeConfigCacheValues(data, profiles[j]->mFormats);
+                writeConfigCacheValues(data, profiles[j]->mChannelMasks);
+            }
+        }
+    }
+
+    size_t numCurvesPos = data.size();
+    data.add(0); // number of curves, filled below
+    for (int i = 0; i < AUDIO_STREAM_CNT; i++) {
+        for (int j = 0; j < DEVICE_CATEGORY_CNT; j++) {
+            const Vector <VolumeCurvePoint>& curve = mConfigVolumeCurves[i][j];
+            if (curve.isEmpty()) {
+                continue;
+            }
+            data.editItemAt(numCurvesPos)++;
+            data.add(i);
+            data.add(j);
+            data.add(curve.size());
+            for (size_t k = 0; k < curve.size(); k++) {
+                uint32_t dB;
+                memcpy(&dB, &curve[k].mDBAttenuation, sizeof(float));
+                data.add((uint32_t)curve[k].mIndex);
+                data.add(dB);
+            }
+        }
+    }
+    data.editItemAt(4) = data.size();
+
+    // write to a temporary file renamed once complete so that a partial cache is never read
+    String8 tmpPath(cachePath);
+    tmpPath.append(".tmp");
+    int fd = open(tmpPath.string(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        ALOGV("writeAudioPolicyConfigCache() cannot create %s", tmpPath.string());
+        return;
+    }
+    size_t size = data.size() * sizeof(uint32_t);
+    ssize_t written = write(fd, data.array(), size);
+    close(fd);
+    if (written != (ssize_t)size || rename(tmpPath.string(), cachePath) != 0) {
+        ALOGW("writeAudioPolicyConfigCache() error writing %s", cachePath);
+        unlink(tmpPath.string());
+    }
+}
+
 void AudioPolicyManagerBase::defaultAudioPolicyConfig(void)
 {
     HwModule *module;
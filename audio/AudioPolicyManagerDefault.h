@@ -27,7 +27,7 @@ class AudioPolicyManagerDefault: public AudioPolicyManagerBase
 
 public:
                 AudioPolicyManagerDefault(AudioPolicyClientInterface *clientInterface)
-                : AudioPolicyManagerBase(clientInterface) {}
+                : AudioPolicyManagerBase(clientInterface) { enableQueryState(); }
 
         virtual ~AudioPolicyManagerDefault() {}
 
@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#define LOG_TAG "AudioRingBuffer"
+#include <utils/Log.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+
+#include "AudioRingBuffer.h"
+
+namespace android_audio_legacy {
+
+// ----------------------------------------------------------------------------
+
+AudioRingBuffer::AudioRingBuffer(size_t size)
+    : mBuffer(new uint8_t[size]), mSize(size),
+      // the largest multiple of the size that fits the positive range of the positions:
+      // offsets stay continuous when positions wrap, whatever the size
+      mWrap((uint32_t)size * (0x80000000U / (uint32_t)size)),
+      mWritePos(0), mReadPos(0), mProducerWaiting(0), mConsumerWaiting(0), mAborted(false)
+{
+}
+
+AudioRingBuffer::~AudioRingBuffer()
+{
+    delete[] mBuffer;
+}
+
+size_t AudioRingBuffer::filled(uint32_t writePos, uint32_t readPos) const
+{
+    return writePos >= readPos ? writePos - readPos : writePos + mWrap - readPos;
+}
+
+uint32_t AudioRingBuffer::advance(uint32_t pos, size_t count) const
+{
+    pos += count;
+    return pos >= mWrap ? pos - mWrap : pos;
+}
+
+size_t AudioRingBuffer::filled() const
+{
+    uint32_t readPos = (uint32_t)android_atomic_acquire_load(&mReadPos);
+    return filled((uint32_t)android_atomic_acquire_load(&mWritePos), readPos);
+}
+
+size_t AudioRingBuffer::write(const void* buffer, size_t bytes)
+{
+    uint32_t writePos = (uint32_t)mWritePos;
+    size_t avail = mSize - filled(writePos, (uint32_t)android_atomic_acquire_load(&mReadPos));
+    size_t count = bytes < avail ? bytes : avail;
+    if (count == 0) {
+        return 0;
+    }
+    size_t offset = writePos % mSize;
+    size_t first = count < mSize - offset ? count : mSize - offset;
+    memcpy(mBuffer + offset, buffer, first);
+    if (count > first) {
+        memcpy(mBuffer, (const uint8_t *)buffer + first, count - first);
+    }
+    android_atomic_release_store((int32_t)advance(writePos, count), &mWritePos);
+    wake(&mConsumerWaiting, mDataCond);
+    return count;
+}
+
+size_t AudioRingBuffer::readBuffer(const uint8_t** buffer, size_t maxBytes) const
+{
+    uint32_t readPos = (uint32_t)mReadPos;
+    size_t count = filled((uint32_t)android_atomic_acquire_load(&mWritePos), readPos);
+    size_t offset = readPos % mSize;
+    if (count > mSize - offset) {
+        count = mSize - offset;
+    }
+    *buffer = mBuffer + offset;
+    return count < maxBytes ? count : maxBytes;
+}
+
+void AudioRingBuffer::advanceRead(size_t bytes)
+{
+    android_atomic_release_store((int32_t)advance((uint32_t)mReadPos, bytes), &mReadPos);
+    wake(&mProducerWaiting, mSpaceCond);
+}
+
+// Called after a position update. The full barrier orders the position store before the
+// load of the waiting flag, as the waiter orders its flag store before its position check:
+// either the waiter sees the new position or this side sees the flag and signals.
+void AudioRingBuffer::wake(volatile int32_t* waiting, Condition& cond)
+{
+    android_memory_barrier();
+    if (android_atomic_acquire_load(waiting) != 0) {
+        Mutex::Autolock _l(mLock);
+        cond.signal();
+    }
+}
+
+bool AudioRingBuffer::waitForSpace(nsecs_t deadline)
+{
+    return waitForFilled(mSize - 1, deadline);
+}
+
+bool AudioRingBuffer::waitForEmpty(nsecs_t deadline)
+{
+    return waitForFilled(0, deadline);
+}
+
+bool AudioRingBuffer::waitForFilled(size_t maxFilled, nsecs_t deadline)
+{
+    Mutex::Autolock _l(mLock);
+    android_atomic_release_store(1, &mProducerWaiting);
+    android_memory_barrier();
+    bool done;
+    while (!(done = filled() <= maxFilled) && !mAborted) {
+        if (deadline == 0) {
+            mSpaceCond.wait(mLock);
+            continue;
+        }
+        nsecs_t now = systemTime();
+        if (now >= deadline) {
+            break;
+        }
+        mSpaceCond.waitRelative(mLock, deadline - now);
+    }
+    android_atomic_release_store(0, &mProducerWaiting);
+    return done;
+}
+
+bool AudioRingBuffer::waitForData()
+{
+    Mutex::Autolock _l(mLock);
+    android_atomic_release_store(1, &mConsumerWaiting);
+    android_memory_barrier();
+    while (filled() == 0 && !mAborted) {
+        mDataCond.wait(mLock);
+    }
+    android_atomic_release_store(0, &mConsumerWaiting);
+    return !mAborted;
+}
+
+void AudioRingBuffer::abort()
+{
+    Mutex::Autolock _l(mLock);
+    mAborted = true;
+    mSpaceCond.broadcast();
+    mDataCond.broadcast();
+}
+
+bool AudioRingBuffer::isEnabled(const char* property)
+{
+    char value[PROPERTY_VALUE_MAX];
+    property_get(property, value, "0");
+    return strcmp(value, "1") == 0 || strcmp(value, "true") == 0;
+}
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_RING_BUFFER_H
+#define ANDROID_AUDIO_RING_BUFFER_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <utils/threads.h>
+#include <utils/Timers.h>
+
+namespace android_audio_legacy {
+    using android::Mutex;
+    using android::Condition;
+
+// ----------------------------------------------------------------------------
+
+// Byte ring between one producer thread and one consumer thread, used by the asynchronous
+// write modes of the legacy output streams. Each side only updates its own position. mLock
+// is only taken by a side that must wait, and by the other side when it finds that side
+// waiting: neither side locks while the ring is neither full nor empty.
+class AudioRingBuffer {
+public:
+                        AudioRingBuffer(size_t size);
+                        ~AudioRingBuffer();
+
+    size_t              size() const { return mSize; }
+    // bytes queued. Can be called from any thread.
+    size_t              filled() const;
+
+    // producer: copies as much of buffer as fits and returns the number of bytes copied
+    size_t              write(const void* buffer, size_t bytes);
+    // producer: waits for free space until deadline, or without limit if deadline is 0.
+    // Returns false on timeout or after abort().
+    bool                waitForSpace(nsecs_t deadline);
+    // producer: waits until the consumer has emptied the ring, see waitForSpace()
+    bool                waitForEmpty(nsecs_t deadline);
+
+    // consumer: returns the number of contiguous bytes, at most maxBytes, readable at *buffer
+    size_t              readBuffer(const uint8_t** buffer, size_t maxBytes) const;
+    // consumer: releases bytes returned by readBuffer()
+    void                advanceRead(size_t bytes);
+    // consumer: waits for data. Returns false after abort().
+    bool                waitForData();
+
+    // fails all current and later waits, e.g. before stopping the consumer thread
+    void                abort();
+
+    // true if the asynchronous write mode is enabled by a boolean system property
+    static bool         isEnabled(const char* property);
+
+private:
+    size_t              filled(uint32_t writePos, uint32_t readPos) const;
+    uint32_t            advance(uint32_t pos, size_t count) const;
+    bool                waitForFilled(size_t maxFilled, nsecs_t deadline);
+    void                wake(volatile int32_t* waiting, Condition& cond);
+
+    uint8_t*            mBuffer;
+    size_t              mSize;
+    uint32_t            mWrap;              // positions wrap at this multiple of mSize
+    volatile int32_t    mWritePos;          // updated by the producer only
+    volatile int32_t    mReadPos;           // updated by the consumer only
+    volatile int32_t    mProducerWaiting;   // set by the producer while it waits
+    volatile int32_t    mConsumerWaiting;   // set by the consumer while it waits
+    Mutex               mLock;              // protects mAborted and the waits below
+    Condition           mSpaceCond;         // signaled when the consumer frees space
+    Condition           mDataCond;          // signaled when the producer queues data
+    bool                mAborted;
+};
+
+// ----------------------------------------------------------------------------
+
+}; // namespace android
+
+#endif // ANDROID_AUDIO_RING_BUFFER_H
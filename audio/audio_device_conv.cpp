@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include <system/audio.h>
+
+#include <hardware_legacy/AudioSystemLegacy.h>
+
+#include "audio_device_conv.h"
+
+namespace android_audio_legacy {
+
+const uint32_t audio_device_conv_table[][HAL_API_REV_NUM] =
+{
+    /* output devices */
+    { AudioSystem::DEVICE_OUT_EARPIECE, AUDIO_DEVICE_OUT_EARPIECE },
+    { AudioSystem::DEVICE_OUT_SPEAKER, AUDIO_DEVICE_OUT_SPEAKER },
+    { AudioSystem::DEVICE_OUT_WIRED_HEADSET, AUDIO_DEVICE_OUT_WIRED_HEADSET },
+    { AudioSystem::DEVICE_OUT_WIRED_HEADPHONE, AUDIO_DEVICE_OUT_WIRED_HEADPHONE },
+    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO, AUDIO_DEVICE_OUT_BLUETOOTH_SCO },
+    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET },
+    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_CARKIT, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT },
+    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP },
+    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES },
+    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER },
+    { AudioSystem::DEVICE_OUT_AUX_DIGITAL, AUDIO_DEVICE_OUT_AUX_DIGITAL },
+    { AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET, AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET },
+    { AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET, AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET },
+    { AudioSystem::DEVICE_OUT_DEFAULT, AUDIO_DEVICE_OUT_DEFAULT },
+    /* input devices */
+    { AudioSystem::DEVICE_IN_COMMUNICATION, AUDIO_DEVICE_IN_COMMUNICATION },
+    { AudioSystem::DEVICE_IN_AMBIENT, AUDIO_DEVICE_IN_AMBIENT },
+    { AudioSystem::DEVICE_IN_BUILTIN_MIC, AUDIO_DEVICE_IN_BUILTIN_MIC },
+    { AudioSystem::DEVICE_IN_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET },
+    { AudioSystem::DEVICE_IN_WIRED_HEADSET, AUDIO_DEVICE_IN_WIRED_HEADSET },
+    { AudioSystem::DEVICE_IN_AUX_DIGITAL, AUDIO_DEVICE_IN_AUX_DIGITAL },
+    { AudioSystem::DEVICE_IN_VOICE_CALL, AUDIO_DEVICE_IN_VOICE_CALL },
+    { AudioSystem::DEVICE_IN_BACK_MIC, AUDIO_DEVICE_IN_BACK_MIC },
+    { AudioSystem::DEVICE_IN_DEFAULT, AUDIO_DEVICE_IN_DEFAULT },
+};
+
+const size_t audio_device_conv_table_size =
+        sizeof(audio_device_conv_table) / sizeof(audio_device_conv_table[0]);
+
+/* Device masks are converted one byte at a time: audio_device_conv_maps[map][i][value] is the
+ * conversion of the device bits value << (8 * i). The maps are built from
+ * audio_device_conv_table on first use. */
+enum {
+    CONV_MAP_1_0_TO_2_0,
+    CONV_MAP_2_0_OUT_TO_1_0,
+    CONV_MAP_2_0_IN_TO_1_0,
+    CONV_MAP_NUM
+};
+
+static uint32_t audio_device_conv_maps[CONV_MAP_NUM][sizeof(uint32_t)][256];
+static pthread_once_t audio_device_conv_maps_once = PTHREAD_ONCE_INIT;
+
+static uint32_t convert_audio_device_bit(uint32_t cur_device, int from_rev, int to_rev)
+{
+    for (size_t i = 0; i < audio_device_conv_table_size; i++) {
+        if (audio_device_conv_table[i][from_rev] == cur_device) {
+            return audio_device_conv_table[i][to_rev];
+        }
+    }
+    return AUDIO_DEVICE_NONE;
+}
+
+static void init_audio_device_conv_maps()
+{
+    for (int map = 0; map < CONV_MAP_NUM; map++) {
+        int from_rev = (map == CONV_MAP_1_0_TO_2_0) ? HAL_API_REV_1_0 : HAL_API_REV_2_0;
+        int to_rev = (map == CONV_MAP_1_0_TO_2_0) ? HAL_API_REV_2_0 : HAL_API_REV_1_0;
+        uint32_t in_bit = (map == CONV_MAP_2_0_IN_TO_1_0) ? AUDIO_DEVICE_BIT_IN : 0;
+
+        for (uint32_t i = 0; i < sizeof(uint32_t); i++) {
+            for (uint32_t value = 0; value < 256; value++) {
+                uint32_t to_device = AUDIO_DEVICE_NONE;
+                for (uint32_t bit = 0; bit < 8; bit++) {
+                    uint32_t cur_device = (value & (1 << bit)) << (8 * i);
+                    /* the input bit of 2.0 masks is not a device */
+                    if (cur_device == 0 ||
+                            (from_rev != HAL_API_REV_1_0 && cur_device == AUDIO_DEVICE_BIT_IN)) {
+                        continue;
+                    }
+                    to_device |= convert_audio_device_bit(cur_device | in_bit, from_rev, to_rev);
+                }
+                audio_device_conv_maps[map][i][value] = to_device;
+            }
+        }
+    }
+}
+
+uint32_t convert_audio_device(uint32_t from_device, int from_rev, int to_rev)
+{
+    int map;
+
+    pthread_once(&audio_device_conv_maps_once, init_audio_device_conv_maps);
+
+    if (from_rev == HAL_API_REV_1_0) {
+        map = CONV_MAP_1_0_TO_2_0;
+    } else if (from_device & AUDIO_DEVICE_BIT_IN) {
+        map = CONV_MAP_2_0_IN_TO_1_0;
+    } else {
+        map = CONV_MAP_2_0_OUT_TO_1_0;
+    }
+
+    const uint32_t (*bytes)[256] = audio_device_conv_maps[map];
+    return bytes[0][from_device & 0xff] |
+           bytes[1][(from_device >> 8) & 0xff] |
+           bytes[2][(from_device >> 16) & 0xff] |
+           bytes[3][from_device >> 24];
+}
+
+}; // namespace android_audio_legacy
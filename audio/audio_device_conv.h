@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2011 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ANDROID_AUDIO_DEVICE_CONV_H
+#define ANDROID_AUDIO_DEVICE_CONV_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+namespace android_audio_legacy {
+
+enum {
+    HAL_API_REV_1_0,    // AudioSystem device masks of the legacy HAL
+    HAL_API_REV_2_0,    // audio_devices_t masks of the audio HAL
+    HAL_API_REV_NUM
+};
+
+/* One row per device: its value in each HAL API revision */
+extern const uint32_t audio_device_conv_table[][HAL_API_REV_NUM];
+extern const size_t audio_device_conv_table_size;
+
+/* Converts a device mask from from_rev to to_rev. Devices without an equivalent are dropped. */
+uint32_t convert_audio_device(uint32_t from_device, int from_rev, int to_rev);
+
+}; // namespace android_audio_legacy
+
+#endif // ANDROID_AUDIO_DEVICE_CONV_H
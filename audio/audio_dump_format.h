@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef ANDROID_AUDIO_DUMP_FORMAT_H
+#define ANDROID_AUDIO_DUMP_FORMAT_H
+
+#include <stdint.h>
+
+/////////////////////////////////////////////////
+//      Capture file format written by AudioDumpInterface and read by audio_dump_reader
+/////////////////////////////////////////////////
+
+// A capture is a sequence of segment files "<name>.<segment>.adump", segment numbers starting
+// at 0. A new segment is started when the current one reaches the configured size or
+// duration; the oldest segments are deleted when more than the configured number exist.
+//
+// Each segment starts with an audio_dump_header followed by records, each made of an
+// audio_dump_record header and "size" bytes of payload. All fields are little endian.
+//
+// Record types:
+// - AUDIO_DUMP_RECORD_PCM: the payload is PCM data as received by the stream.
+// - AUDIO_DUMP_RECORD_PCM_DELTA: 16 bit PCM only. For each sample in interleaved order, the
+//   difference with the previous sample of the same channel (0 before the first frame of the
+//   record) is zigzag encoded ((d << 1) ^ (d >> 31)) and written as a little endian base 128
+//   varint: 7 bits per byte, high bit set on all bytes but the last.
+// - AUDIO_DUMP_RECORD_XRUN: no payload, pcmSize bytes of audio were lost because the capture
+//   could not keep up.
+//
+// "position" is the index of the first frame of the record since the capture started,
+// counting lost frames, so that gaps can be filled with silence. "timestamp" is the
+// monotonic time in ns when the stream received this frame; the segment header gives the
+// wall clock time matching a monotonic time.
+
+#define AUDIO_DUMP_MAGIC 0x504d4441     // "ADMP"
+#define AUDIO_DUMP_VERSION 1
+#define AUDIO_DUMP_FILE_SUFFIX ".adump"
+
+enum {
+    AUDIO_DUMP_RECORD_PCM = 1,
+    AUDIO_DUMP_RECORD_PCM_DELTA = 2,
+    AUDIO_DUMP_RECORD_XRUN = 3
+};
+
+struct audio_dump_header {
+    uint32_t magic;         // AUDIO_DUMP_MAGIC
+    uint16_t version;       // AUDIO_DUMP_VERSION
+    uint16_t headerSize;    // sizeof(struct audio_dump_header), records start after it
+    uint32_t sampleRate;
+    uint32_t channels;      // AudioSystem channel mask
+    uint32_t format;        // AudioSystem format: 1 for 16 bit PCM, 2 for 8 bit PCM
+    uint32_t frameSize;     // bytes per frame
+    uint32_t segment;       // index of this segment file
+    uint32_t reserved;
+    int64_t realtime;       // wall clock time in ns when the segment was started
+    int64_t monotonic;      // monotonic time in ns matching realtime
+};
+
+struct audio_dump_record {
+    uint32_t type;          // AUDIO_DUMP_RECORD_xxx
+    uint32_t size;          // payload bytes following this header
+    uint32_t pcmSize;       // PCM bytes carried by the payload, or lost for an xrun
+    uint32_t reserved;
+    int64_t position;       // frames since the capture started
+    int64_t timestamp;      // monotonic time in ns
+};
+
+#endif  // ANDROID_AUDIO_DUMP_FORMAT_H
@@ -0,0 +1,425 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// audio_dump_reader: converts the segment files of a capture written by AudioDumpInterface
+// (see audio_dump_format.h) to a WAV file and lists the xruns.
+//
+// usage: audio_dump_reader [-o output.wav] [-v] segment...
+//
+// Segments are sorted by their segment index, so a shell glob such as
+// "dump_out_0_1.*.adump" can be passed. Audio lost by the capture, and segments deleted by
+// rotation after the first one given, are replaced by silence so that the WAV file keeps
+// the timing of the stream. The host must be little endian like the device.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "audio_dump_format.h"
+
+namespace android_audio_legacy {
+
+// legacy AudioSystem formats
+static const uint32_t kFormatPcm16Bit = 1;
+static const uint32_t kFormatPcm8Bit = 2;
+
+struct Segment {
+    const char *mPath;
+    struct audio_dump_header mHeader;
+};
+
+static bool readHeader(const char *path, struct audio_dump_header *header)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open %s\n", path);
+        return false;
+    }
+    size_t count = fread(header, 1, sizeof(*header), file);
+    fclose(file);
+    if (count != sizeof(*header) || header->magic != AUDIO_DUMP_MAGIC) {
+        fprintf(stderr, "%s: not a capture file\n", path);
+        return false;
+    }
+    if (header->version != AUDIO_DUMP_VERSION || header->headerSize < sizeof(*header)) {
+        fprintf(stderr, "%s: unsupported version %u\n", path, header->version);
+        return false;
+    }
+    if (header->frameSize == 0 || header->sampleRate == 0) {
+        fprintf(stderr, "%s: invalid stream configuration\n", path);
+        return false;
+    }
+    return true;
+}
+
+static int compareSegments(const void *a, const void *b)
+{
+    uint32_t sa = ((const Segment *)a)->mHeader.segment;
+    uint32_t sb = ((const Segment *)b)->mHeader.segment;
+    return sa < sb ? -1 : (sa > sb ? 1 : 0);
+}
+
+static void writeLe32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static void writeLe16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void writeWavHeader(FILE *out, const struct audio_dump_header& header, uint32_t dataSize)
+{
+    uint8_t wav[44];
+    uint32_t bytesPerSample = header.format == kFormatPcm8Bit ? 1 : 2;
+    uint32_t channelCount = header.frameSize / bytesPerSample;
+
+    memcpy(wav, "RIFF", 4);
+    writeLe32(wav + 4, 36 + dataSize);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    writeLe32(wav + 16, 16);
+    writeLe16(wav + 20, 1);     // PCM
+    writeLe16(wav + 22, channelCount);
+    writeLe32(wav + 24, header.sampleRate);
+    writeLe32(wav + 28, header.sampleRate * header.frameSize);
+    writeLe16(wav + 32, header.frameSize);
+    writeLe16(wav + 34, bytesPerSample * 8);
+    memcpy(wav + 36, "data", 4);
+    writeLe32(wav + 40, dataSize);
+    fseek(out, 0, SEEK_SET);
+    fwrite(wav, 1, sizeof(wav), out);
+}
+
+// Decodes an AUDIO_DUMP_RECORD_PCM_DELTA payload into pcmSize bytes of 16 bit PCM.
+static bool decodeDelta(const uint8_t *in, size_t size, int16_t *out, size_t pcmSize,
+                        uint32_t channelCount)
+{
+    int32_t *previous = (int32_t *)calloc(channelCount, sizeof(int32_t));
+    const uint8_t *end = in + size;
+    size_t count = pcmSize / sizeof(int16_t);
+    uint32_t channel = 0;
+    bool ok = true;
+
+    for (size_t i = 0; i < count; i++) {
+        uint32_t value = 0;
+        int shift = 0;
+        for (;;) {
+            if (in == end || shift > 28) {
+                ok = false;
+                break;
+            }
+            uint8_t byte = *in++;
+            value |= (uint32_t)(byte & 0x7f) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0) {
+                break;
+            }
+        }
+        if (!ok) {
+            break;
+        }
+        int32_t delta = (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+        previous[channel] += delta;
+        out[i] = previous[channel];
+        if (++channel == channelCount) {
+            channel = 0;
+        }
+    }
+    free(previous);
+    return ok && in == end;
+}
+
+class Converter {
+public:
+    Converter(FILE *out, const struct audio_dump_header& header, bool verbose)
+        : mOut(out), mHeader(header), mVerbose(verbose), mStarted(false), mPosition(0),
+          mFirstPosition(0), mDataSize(0), mXrunCount(0), mLostFrames(0), mGapFrames(0) {}
+
+    bool convertSegment(const Segment& segment);
+    void report();
+
+private:
+    void writeSilence(int64_t frames);
+    void writePcm(const void *data, size_t size, int64_t position);
+    void printTime(const struct audio_dump_header& header, int64_t timestamp);
+
+    FILE *mOut;
+    struct audio_dump_header mHeader;
+    bool mVerbose;
+    bool mStarted;
+    int64_t mPosition;          // next frame expected
+    int64_t mFirstPosition;
+    uint64_t mDataSize;
+    uint32_t mXrunCount;
+    int64_t mLostFrames;        // frames lost by the capture
+    int64_t mGapFrames;         // frames missing because segments were deleted
+};
+
+void Converter::writeSilence(int64_t frames)
+{
+    uint8_t silence[4096];
+    memset(silence, mHeader.format == kFormatPcm8Bit ? 0x80 : 0, sizeof(silence));
+    uint64_t bytes = frames * mHeader.frameSize;
+    while (bytes > 0) {
+        size_t count = bytes < sizeof(silence) ? bytes : sizeof(silence);
+        fwrite(silence, 1, count, mOut);
+        bytes -= count;
+    }
+    mDataSize += frames * mHeader.frameSize;
+    mPosition += frames;
+}
+
+void Converter::writePcm(const void *data, size_t size, int64_t position)
+{
+    if (!mStarted) {
+        mStarted = true;
+        mFirstPosition = position;
+        mPosition = position;
+    }
+    if (position > mPosition) {
+        mGapFrames += position - mPosition;
+        writeSilence(position - mPosition);
+    } else if (position < mPosition) {
+        fprintf(stderr, "record at frame %lld overlaps previous data, skipped\n",
+                (long long)position);
+        return;
+    }
+    fwrite(data, 1, size, mOut);
+    mDataSize += size;
+    mPosition += size / mHeader.frameSize;
+}
+
+void Converter::printTime(const struct audio_dump_header& header, int64_t timestamp)
+{
+    int64_t realtime = header.realtime + (timestamp - header.monotonic);
+    printf("%lld.%06lld s (%.3f s into the WAV file)",
+           (long long)(realtime / 1000000000), (long long)(realtime % 1000000000 / 1000),
+           (double)(mPosition - mFirstPosition) / mHeader.sampleRate);
+}
+
+bool Converter::convertSegment(const Segment& segment)
+{
+    const struct audio_dump_header& header = segment.mHeader;
+    if (header.sampleRate != mHeader.sampleRate || header.channels != mHeader.channels ||
+            header.format != mHeader.format || header.frameSize != mHeader.frameSize) {
+        fprintf(stderr, "%s: stream configuration differs from the first segment\n",
+                segment.mPath);
+        return false;
+    }
+    FILE *file = fopen(segment.mPath, "rb");
+    if (file == NULL || fseek(file, header.headerSize, SEEK_SET) != 0) {
+        fprintf(stderr, "cannot read %s\n", segment.mPath);
+        if (file != NULL) {
+            fclose(file);
+        }
+        return false;
+    }
+    if (mVerbose) {
+        printf("segment %u: %s\n", header.segment, segment.mPath);
+    }
+
+    uint8_t *payload = NULL;
+    uint8_t *pcm = NULL;
+    size_t payloadCapacity = 0;
+    size_t pcmCapacity = 0;
+    uint32_t channelCount = header.frameSize / sizeof(int16_t);
+    bool ok = true;
+    struct audio_dump_record record;
+
+    while (fread(&record, 1, sizeof(record), file) == sizeof(record)) {
+        if (record.size > payloadCapacity) {
+            payloadCapacity = record.size;
+            payload = (uint8_t *)realloc(payload, payloadCapacity);
+        }
+        if (record.size != 0 && fread(payload, 1, record.size, file) != record.size) {
+            // the device stopped before the capture was closed
+            fprintf(stderr, "%s: truncated record at frame %lld\n", segment.mPath,
+                    (long long)record.position);
+            break;
+        }
+        if (record.pcmSize % header.frameSize != 0) {
+            fprintf(stderr, "%s: invalid record size at frame %lld\n", segment.mPath,
+                    (long long)record.position);
+            ok = false;
+            break;
+        }
+
+        switch (record.type) {
+        case AUDIO_DUMP_RECORD_PCM:
+            if (record.size != record.pcmSize) {
+                fprintf(stderr, "%s: invalid PCM record at frame %lld\n", segment.mPath,
+                        (long long)record.position);
+                ok = false;
+                break;
+            }
+            writePcm(payload, record.size, record.position);
+            break;
+
+        case AUDIO_DUMP_RECORD_PCM_DELTA:
+            if (header.format != kFormatPcm16Bit) {
+                fprintf(stderr, "%s: delta record for a format other than 16 bit PCM\n",
+                        segment.mPath);
+                ok = false;
+                break;
+            }
+            if (record.pcmSize > pcmCapacity) {
+                pcmCapacity = record.pcmSize;
+                pcm = (uint8_t *)realloc(pcm, pcmCapacity);
+            }
+            if (!decodeDelta(payload, record.size, (int16_t *)pcm, record.pcmSize,
+                             channelCount)) {
+                fprintf(stderr, "%s: corrupted delta record at frame %lld\n", segment.mPath,
+                        (long long)record.position);
+                ok = false;
+                break;
+            }
+            writePcm(pcm, record.pcmSize, record.position);
+            break;
+
+        case AUDIO_DUMP_RECORD_XRUN: {
+            int64_t frames = record.pcmSize / header.frameSize;
+            if (!mStarted) {
+                mStarted = true;
+                mFirstPosition = record.position;
+                mPosition = record.position;
+            }
+            printf("xrun: %lld frames lost at frame %lld, ", (long long)frames,
+                   (long long)record.position);
+            printTime(header, record.timestamp);
+            printf("\n");
+            if (record.position > mPosition) {
+                mGapFrames += record.position - mPosition;
+                writeSilence(record.position - mPosition);
+            }
+            if (record.position == mPosition) {
+                writeSilence(frames);
+            }
+            mXrunCount++;
+            mLostFrames += frames;
+            } break;
+
+        default:
+            fprintf(stderr, "%s: unknown record type %u at frame %lld\n", segment.mPath,
+                    record.type, (long long)record.position);
+            ok = false;
+            break;
+        }
+        if (!ok) {
+            break;
+        }
+    }
+    free(payload);
+    free(pcm);
+    fclose(file);
+    return ok;
+}
+
+void Converter::report()
+{
+    uint32_t dataSize = mDataSize > 0xffffffffULL - 36 ? 0xffffffff - 36 : mDataSize;
+    fflush(mOut);
+    writeWavHeader(mOut, mHeader, dataSize);
+
+    uint64_t frames = mDataSize / mHeader.frameSize;
+    printf("%llu frames, %.3f s at %u Hz, frame size %u\n", (unsigned long long)frames,
+           (double)frames / mHeader.sampleRate, mHeader.sampleRate, mHeader.frameSize);
+    printf("%u xruns, %lld frames lost, %lld frames missing between segments\n", mXrunCount,
+           (long long)mLostFrames, (long long)mGapFrames);
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-o output.wav] [-v] segment...\n", name);
+}
+
+static int readerMain(int argc, char **argv)
+{
+    const char *outputFile = "audio_dump.wav";
+    bool verbose = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:v")) != -1) {
+        switch (opt) {
+        case 'o':
+            outputFile = optarg;
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t segmentCount = argc - optind;
+    Segment *segments = new Segment[segmentCount];
+    for (size_t i = 0; i < segmentCount; i++) {
+        segments[i].mPath = argv[optind + i];
+        if (!readHeader(segments[i].mPath, &segments[i].mHeader)) {
+            delete[] segments;
+            return 1;
+        }
+    }
+    qsort(segments, segmentCount, sizeof(Segment), compareSegments);
+    for (size_t i = 1; i < segmentCount; i++) {
+        if (segments[i].mHeader.segment == segments[i - 1].mHeader.segment) {
+            fprintf(stderr, "%s and %s have the same segment index\n",
+                    segments[i - 1].mPath, segments[i].mPath);
+            delete[] segments;
+            return 1;
+        }
+    }
+
+    FILE *out = fopen(outputFile, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "cannot create %s\n", outputFile);
+        delete[] segments;
+        return 1;
+    }
+    // the header is written once the data size is known
+    writeWavHeader(out, segments[0].mHeader, 0);
+
+    Converter converter(out, segments[0].mHeader, verbose);
+    int ret = 0;
+    for (size_t i = 0; i < segmentCount; i++) {
+        if (!converter.convertSegment(segments[i])) {
+            ret = 1;
+            break;
+        }
+    }
+    converter.report();
+    fclose(out);
+    delete[] segments;
+    return ret;
+}
+
+}; // namespace android_audio_legacy
+
+int main(int argc, char **argv)
+{
+    return android_audio_legacy::readerMain(argc, argv);
+}
@@ -18,6 +18,9 @@
 //#define LOG_NDEBUG 0
 
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <hardware/hardware.h>
 #include <system/audio.h>
@@ -26,6 +29,8 @@
 #include <hardware_legacy/AudioHardwareInterface.h>
 #include <hardware_legacy/AudioSystemLegacy.h>
 
+#include "audio_device_conv.h"
+
 namespace android_audio_legacy {
 
 extern "C" {
@@ -53,65 +58,81 @@ struct legacy_stream_in {
 };
 
 
-enum {
-    HAL_API_REV_1_0,
-    HAL_API_REV_2_0,
-    HAL_API_REV_NUM
-} hal_api_rev;
-
-static uint32_t audio_device_conv_table[][HAL_API_REV_NUM] =
-{
-    /* output devices */
-    { AudioSystem::DEVICE_OUT_EARPIECE, AUDIO_DEVICE_OUT_EARPIECE },
-    { AudioSystem::DEVICE_OUT_SPEAKER, AUDIO_DEVICE_OUT_SPEAKER },
-    { AudioSystem::DEVICE_OUT_WIRED_HEADSET, AUDIO_DEVICE_OUT_WIRED_HEADSET },
-    { AudioSystem::DEVICE_OUT_WIRED_HEADPHONE, AUDIO_DEVICE_OUT_WIRED_HEADPHONE },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO, AUDIO_DEVICE_OUT_BLUETOOTH_SCO },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_HEADSET },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_SCO_CARKIT, AUDIO_DEVICE_OUT_BLUETOOTH_SCO_CARKIT },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_HEADPHONES },
-    { AudioSystem::DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER, AUDIO_DEVICE_OUT_BLUETOOTH_A2DP_SPEAKER },
-    { AudioSystem::DEVICE_OUT_AUX_DIGITAL, AUDIO_DEVICE_OUT_AUX_DIGITAL },
-    { AudioSystem::DEVICE_OUT_ANLG_DOCK_HEADSET, AUDIO_DEVICE_OUT_ANLG_DOCK_HEADSET },
-    { AudioSystem::DEVICE_OUT_DGTL_DOCK_HEADSET, AUDIO_DEVICE_OUT_DGTL_DOCK_HEADSET },
-    { AudioSystem::DEVICE_OUT_DEFAULT, AUDIO_DEVICE_OUT_DEFAULT },
-    /* input devices */
-    { AudioSystem::DEVICE_IN_COMMUNICATION, AUDIO_DEVICE_IN_COMMUNICATION },
-    { AudioSystem::DEVICE_IN_AMBIENT, AUDIO_DEVICE_IN_AMBIENT },
-    { AudioSystem::DEVICE_IN_BUILTIN_MIC, AUDIO_DEVICE_IN_BUILTIN_MIC },
-    { AudioSystem::DEVICE_IN_BLUETOOTH_SCO_HEADSET, AUDIO_DEVICE_IN_BLUETOOTH_SCO_HEADSET },
-    { AudioSystem::DEVICE_IN_WIRED_HEADSET, AUDIO_DEVICE_IN_WIRED_HEADSET },
-    { AudioSystem::DEVICE_IN_AUX_DIGITAL, AUDIO_DEVICE_IN_AUX_DIGITAL },
-    { AudioSystem::DEVICE_IN_VOICE_CALL, AUDIO_DEVICE_IN_VOICE_CALL },
-    { AudioSystem::DEVICE_IN_BACK_MIC, AUDIO_DEVICE_IN_BACK_MIC },
-    { AudioSystem::DEVICE_IN_DEFAULT, AUDIO_DEVICE_IN_DEFAULT },
-};
+/* max length of a routing value written by write_routing_parameters(): sign and 10 digits */
+#define ROUTING_VALUE_MAX_LEN 11
 
-static uint32_t convert_audio_device(uint32_t from_device, int from_rev, int to_rev)
+/* Looks for the routing key in a "key1=value1;key2=value2" string without allocating.
+ * Returns a pointer to its value, the value length in *len and the parsed device in *device,
+ * or NULL if there is no routing key with an integer value. */
+static const char *find_routing_value(const char *kvpairs, size_t *len, int *device)
 {
-    const uint32_t k_num_devices = sizeof(audio_device_conv_table)/sizeof(uint32_t)/HAL_API_REV_NUM;
-    uint32_t to_device = AUDIO_DEVICE_NONE;
-    uint32_t in_bit = 0;
+    const size_t key_len = strlen(AUDIO_PARAMETER_STREAM_ROUTING);
+    const char *pair = kvpairs;
 
-    if (from_rev != HAL_API_REV_1_0) {
-        in_bit = from_device & AUDIO_DEVICE_BIT_IN;
-        from_device &= ~AUDIO_DEVICE_BIT_IN;
+    while (*pair != '\0') {
+        const char *end = strchr(pair, ';');
+        if (end == NULL) {
+            end = pair + strlen(pair);
+        }
+        if (strncmp(pair, AUDIO_PARAMETER_STREAM_ROUTING, key_len) == 0 &&
+                pair[key_len] == '=') {
+            const char *value = pair + key_len + 1;
+            if (sscanf(value, "%d", device) != 1) {
+                return NULL;
+            }
+            *len = end - value;
+            return value;
+        }
+        pair = (*end == ';') ? end + 1 : end;
     }
+    return NULL;
+}
 
-    while (from_device) {
-        uint32_t i = 31 - __builtin_clz(from_device);
-        uint32_t cur_device = (1 << i) | in_bit;
+/* Copies kvpairs to buf, replacing the routing value returned by find_routing_value() with
+ * device. buf must hold strlen(kvpairs) + ROUTING_VALUE_MAX_LEN + 1 chars. */
+static void write_routing_parameters(char *buf, const char *kvpairs,
+                                     const char *value, size_t len, int device)
+{
+    size_t prefix_len = value - kvpairs;
+    memcpy(buf, kvpairs, prefix_len);
+    buf += prefix_len;
+    buf += sprintf(buf, "%d", device);
+    strcpy(buf, value + len);
+}
 
-        for (i = 0; i < k_num_devices; i++) {
-            if (audio_device_conv_table[i][from_rev] == cur_device) {
-                to_device |= audio_device_conv_table[i][to_rev];
-                break;
-            }
-        }
-        from_device &= ~cur_device;
+/* Returns kvpairs with its routing value converted from from_rev to to_rev */
+static String8 convert_routing_parameters(const char *kvpairs, int from_rev, int to_rev)
+{
+    size_t len;
+    int device;
+    const char *value = find_routing_value(kvpairs, &len, &device);
+    if (value == NULL) {
+        return String8(kvpairs);
     }
-    return to_device;
+    String8 s8;
+    char *buf = s8.lockBuffer(strlen(kvpairs) + ROUTING_VALUE_MAX_LEN);
+    write_routing_parameters(buf, kvpairs, value, len,
+                             convert_audio_device(device, from_rev, to_rev));
+    s8.unlockBuffer();
+    return s8;
+}
+
+/* Returns a malloc'ed copy of kvpairs with its routing value converted from from_rev to to_rev,
+ * as expected from get_parameters() */
+static char *dup_converted_routing_parameters(const char *kvpairs, int from_rev, int to_rev)
+{
+    size_t len;
+    int device;
+    const char *value = find_routing_value(kvpairs, &len, &device);
+    if (value == NULL) {
+        return strdup(kvpairs);
+    }
+    char *buf = (char *)malloc(strlen(kvpairs) + ROUTING_VALUE_MAX_LEN + 1);
+    if (buf != NULL) {
+        write_routing_parameters(buf, kvpairs, value, len,
+                                 convert_audio_device(device, from_rev, to_rev));
+    }
+    return buf;
 }
 
 
@@ -183,18 +204,9 @@ static int out_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
     struct legacy_stream_out *out =
         reinterpret_cast<struct legacy_stream_out *>(stream);
-    int val;
-    String8 s8 = String8(kvpairs);
-    AudioParameter parms = AudioParameter(String8(kvpairs));
-
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_2_0, HAL_API_REV_1_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
 
-    return out->legacy_out->setParameters(s8);
+    return out->legacy_out->setParameters(
+            convert_routing_parameters(kvpairs, HAL_API_REV_2_0, HAL_API_REV_1_0));
 }
 
 static char * out_get_parameters(const struct audio_stream *stream, const char *keys)
@@ -202,19 +214,10 @@ static char * out_get_parameters(const struct audio_stream *stream, const char *
     const struct legacy_stream_out *out =
         reinterpret_cast<const struct legacy_stream_out *>(stream);
     String8 s8;
-    int val;
 
     s8 = out->legacy_out->getParameters(String8(keys));
 
-    AudioParameter parms = AudioParameter(s8);
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_1_0, HAL_API_REV_2_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
-
-    return strdup(s8.string());
+    return dup_converted_routing_parameters(s8.string(), HAL_API_REV_1_0, HAL_API_REV_2_0);
 }
 
 static uint32_t out_get_latency(const struct audio_stream_out *stream)
@@ -333,18 +336,9 @@ static int in_set_parameters(struct audio_stream *stream, const char *kvpairs)
 {
     struct legacy_stream_in *in =
         reinterpret_cast<struct legacy_stream_in *>(stream);
-    int val;
-    AudioParameter parms = AudioParameter(String8(kvpairs));
-    String8 s8 = String8(kvpairs);
-
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_2_0, HAL_API_REV_1_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
 
-    return in->legacy_in->setParameters(s8);
+    return in->legacy_in->setParameters(
+            convert_routing_parameters(kvpairs, HAL_API_REV_2_0, HAL_API_REV_1_0));
 }
 
 static char * in_get_parameters(const struct audio_stream *stream,
@@ -353,19 +347,10 @@ static char * in_get_parameters(const struct audio_stream *stream,
     const struct legacy_stream_in *in =
         reinterpret_cast<const struct legacy_stream_in *>(stream);
     String8 s8;
-    int val;
 
     s8 = in->legacy_in->getParameters(String8(keys));
 
-    AudioParameter parms = AudioParameter(s8);
-    if (parms.getInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val) == NO_ERROR) {
-        val = convert_audio_device(val, HAL_API_REV_1_0, HAL_API_REV_2_0);
-        parms.remove(String8(AUDIO_PARAMETER_STREAM_ROUTING));
-        parms.addInt(String8(AUDIO_PARAMETER_STREAM_ROUTING), val);
-        s8 = parms.toString();
-    }
-
-    return strdup(s8.string());
+    return dup_converted_routing_parameters(s8.string(), HAL_API_REV_1_0, HAL_API_REV_2_0);
 }
 
 static int in_set_gain(struct audio_stream_in *stream, float gain)
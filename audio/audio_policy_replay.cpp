@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// audio_policy_replay: replays a trace of policy calls against AudioPolicyManagerBase driven
+// by a stub AudioPolicyClientInterface and reports throughput and per call latency.
+//
+// usage: audio_policy_replay [-c audio_policy.conf] [-n iterations] [-d] trace
+//
+// This is a target executable (see Android.mk) but it only uses the policy manager: it can
+// be run from adb shell on any device or emulator, with the audio services stopped or not.
+//
+// The trace is a text file with one policy call per line. Empty lines and lines starting
+// with '#' are ignored. Numbers are decimal or 0x prefixed hexadecimal. Output handles
+// returned by getOutput() are stored in numbered slots (0 to MAX_SLOTS - 1).
+//
+//   connect <device> [address]              setDeviceConnectionState(AVAILABLE)
+//   disconnect <device> [address]           setDeviceConnectionState(UNAVAILABLE)
+//   phone <mode>                            setPhoneState()
+//   force <usage> <config>                  setForceUse()
+//   volume <stream> <index> [device]        setStreamVolumeIndex()
+//   output <slot> <stream> [rate format channel_mask flags]   getOutput()
+//   start <slot> <stream> [session]         startOutput()
+//   stop <slot> <stream> [session]          stopOutput()
+//   release <slot>                          releaseOutput()
+
+#define LOG_TAG "audio_policy_replay"
+//#define LOG_NDEBUG 0
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <utils/Vector.h>
+#include <hardware_legacy/AudioPolicyManagerBase.h>
+
+namespace android_audio_legacy {
+
+// stub client: accepts every request without touching any audio hardware
+class ReplayClient : public AudioPolicyClientInterface
+{
+public:
+    ReplayClient() : mNextHandle(1) {}
+    virtual ~ReplayClient() {}
+
+    virtual audio_module_handle_t loadHwModule(const char *name)
+    {
+        return mNextHandle++;
+    }
+    virtual audio_io_handle_t openOutput(audio_module_handle_t module,
+                                         audio_devices_t *pDevices,
+                                         uint32_t *pSamplingRate,
+                                         audio_format_t *pFormat,
+                                         audio_channel_mask_t *pChannelMask,
+                                         uint32_t *pLatencyMs,
+                                         audio_output_flags_t flags,
+                                         const audio_offload_info_t *offloadInfo)
+    {
+        if (*pSamplingRate == 0) {
+            *pSamplingRate = 44100;
+        }
+        if (*pFormat == AUDIO_FORMAT_DEFAULT) {
+            *pFormat = AUDIO_FORMAT_PCM_16_BIT;
+        }
+        if (*pChannelMask == 0) {
+            *pChannelMask = AUDIO_CHANNEL_OUT_STEREO;
+        }
+        *pLatencyMs = 20;
+        return mNextHandle++;
+    }
+    virtual audio_io_handle_t openDuplicateOutput(audio_io_handle_t output1,
+                                                  audio_io_handle_t output2)
+    {
+        return mNextHandle++;
+    }
+    virtual status_t closeOutput(audio_io_handle_t output) { return NO_ERROR; }
+    virtual status_t suspendOutput(audio_io_handle_t output) { return NO_ERROR; }
+    virtual status_t restoreOutput(audio_io_handle_t output) { return NO_ERROR; }
+    virtual audio_io_handle_t openInput(audio_module_handle_t module,
+                                        audio_devices_t *pDevices,
+                                        uint32_t *pSamplingRate,
+                                        audio_format_t *pFormat,
+                                        audio_channel_mask_t *pChannelMask)
+    {
+        return mNextHandle++;
+    }
+    virtual status_t closeInput(audio_io_handle_t input) { return NO_ERROR; }
+    virtual status_t setStreamVolume(AudioSystem::stream_type stream, float volume,
+                                     audio_io_handle_t output, int delayMs)
+    {
+        return NO_ERROR;
+    }
+    virtual status_t setStreamOutput(AudioSystem::stream_type stream, audio_io_handle_t output)
+    {
+        return NO_ERROR;
+    }
+    virtual void setParameters(audio_io_handle_t ioHandle, const String8& keyValuePairs,
+                               int delayMs) {}
+    virtual String8 getParameters(audio_io_handle_t ioHandle, const String8& keys)
+    {
+        return String8("");
+    }
+    virtual status_t startTone(ToneGenerator::tone_type tone, AudioSystem::stream_type stream)
+    {
+        return NO_ERROR;
+    }
+    virtual status_t stopTone() { return NO_ERROR; }
+    virtual status_t setVoiceVolume(float volume, int delayMs) { return NO_ERROR; }
+    virtual status_t moveEffects(int session, audio_io_handle_t srcOutput,
+                                 audio_io_handle_t dstOutput)
+    {
+        return NO_ERROR;
+    }
+
+private:
+    int mNextHandle;
+};
+
+enum replay_op {
+    OP_CONNECT,
+    OP_DISCONNECT,
+    OP_PHONE,
+    OP_FORCE,
+    OP_VOLUME,
+    OP_OUTPUT,
+    OP_START,
+    OP_STOP,
+    OP_RELEASE,
+    NUM_OPS
+};
+
+static const char * const sOpNames[NUM_OPS] = {
+    "connect",
+    "disconnect",
+    "phone",
+    "force",
+    "volume",
+    "output",
+    "start",
+    "stop",
+    "release",
+};
+
+static const int MAX_ARGS = 6;
+static const int MAX_SLOTS = 32;
+
+struct ReplayCall {
+    replay_op mOp;
+    uint32_t mArgs[MAX_ARGS];
+    int mArgCount;
+    char mAddress[MAX_DEVICE_ADDRESS_LEN];
+};
+
+static uint32_t argOrDefault(const ReplayCall& call, int index, uint32_t defaultValue)
+{
+    return index < call.mArgCount ? call.mArgs[index] : defaultValue;
+}
+
+static status_t parseTrace(const char *path, Vector<ReplayCall>& calls)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "cannot open trace %s\n", path);
+        return NAME_NOT_FOUND;
+    }
+
+    char line[256];
+    int lineNum = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        lineNum++;
+        char *saveptr;
+        char *token = strtok_r(line, " \t\r\n", &saveptr);
+        if (token == NULL || token[0] == '#') {
+            continue;
+        }
+        ReplayCall call;
+        memset(&call, 0, sizeof(call));
+        int op;
+        for (op = 0; op < NUM_OPS; op++) {
+            if (strcmp(token, sOpNames[op]) == 0) {
+                break;
+            }
+        }
+        if (op == NUM_OPS) {
+            fprintf(stderr, "%s:%d: unknown call %s\n", path, lineNum, token);
+            fclose(file);
+            return BAD_VALUE;
+        }
+        call.mOp = (replay_op)op;
+        while ((token = strtok_r(NULL, " \t\r\n", &saveptr)) != NULL) {
+            // the optional device address is the only non numeric argument
+            if ((call.mOp == OP_CONNECT || call.mOp == OP_DISCONNECT) && call.mArgCount == 1) {
+                strncpy(call.mAddress, token, MAX_DEVICE_ADDRESS_LEN - 1);
+                continue;
+            }
+            if (call.mArgCount == MAX_ARGS) {
+                fprintf(stderr, "%s:%d: too many arguments\n", path, lineNum);
+                fclose(file);
+                return BAD_VALUE;
+            }
+            call.mArgs[call.mArgCount++] = strtoul(token, NULL, 0);
+        }
+        if ((call.mOp == OP_OUTPUT || call.mOp == OP_START || call.mOp == OP_STOP ||
+                call.mOp == OP_RELEASE) && argOrDefault(call, 0, MAX_SLOTS) >= MAX_SLOTS) {
+            fprintf(stderr, "%s:%d: invalid output slot\n", path, lineNum);
+            fclose(file);
+            return BAD_VALUE;
+        }
+        calls.add(call);
+    }
+    fclose(file);
+    return NO_ERROR;
+}
+
+static void replayCall(AudioPolicyManagerBase *manager, const ReplayCall& call,
+                       audio_io_handle_t *slots)
+{
+    switch (call.mOp) {
+    case OP_CONNECT:
+    case OP_DISCONNECT:
+        manager->setDeviceConnectionState((audio_devices_t)argOrDefault(call, 0, 0),
+                                          call.mOp == OP_CONNECT ?
+                                                  AudioSystem::DEVICE_STATE_AVAILABLE :
+                                                  AudioSystem::DEVICE_STATE_UNAVAILABLE,
+                                          call.mAddress);
+        break;
+    case OP_PHONE:
+        manager->setPhoneState(argOrDefault(call, 0, AudioSystem::MODE_NORMAL));
+        break;
+    case OP_FORCE:
+        manager->setForceUse((AudioSystem::force_use)argOrDefault(call, 0, 0),
+                             (AudioSystem::forced_config)argOrDefault(call, 1, 0));
+        break;
+    case OP_VOLUME:
+        manager->setStreamVolumeIndex((AudioSystem::stream_type)argOrDefault(call, 0, 0),
+                                      argOrDefault(call, 1, 0),
+                                      (audio_devices_t)argOrDefault(call, 2,
+                                                                    AUDIO_DEVICE_OUT_DEFAULT));
+        break;
+    case OP_OUTPUT:
+        slots[call.mArgs[0]] = manager->getOutput(
+                (AudioSystem::stream_type)argOrDefault(call, 1, AudioSystem::MUSIC),
+                argOrDefault(call, 2, 0),
+                argOrDefault(call, 3, AudioSystem::FORMAT_DEFAULT),
+                argOrDefault(call, 4, 0),
+                (AudioSystem::output_flags)argOrDefault(call, 5,
+                                                        AudioSystem::OUTPUT_FLAG_INDIRECT));
+        break;
+    case OP_START:
+        manager->startOutput(slots[call.mArgs[0]],
+                             (AudioSystem::stream_type)argOrDefault(call, 1, AudioSystem::MUSIC),
+                             argOrDefault(call, 2, 0));
+        break;
+    case OP_STOP:
+        manager->stopOutput(slots[call.mArgs[0]],
+                            (AudioSystem::stream_type)argOrDefault(call, 1, AudioSystem::MUSIC),
+                            argOrDefault(call, 2, 0));
+        break;
+    case OP_RELEASE:
+        manager->releaseOutput(slots[call.mArgs[0]]);
+        slots[call.mArgs[0]] = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+static int compareDurations(const void *a, const void *b)
+{
+    nsecs_t da = *(const nsecs_t *)a;
+    nsecs_t db = *(const nsecs_t *)b;
+    return (da > db) - (da < db);
+}
+
+static void report(Vector<nsecs_t> *durations, nsecs_t elapsed, size_t callCount)
+{
+    printf("%zu calls in %.3f ms: %.0f calls/s\n", callCount, elapsed / 1000000.0,
+           elapsed > 0 ? callCount * 1000000000.0 / elapsed : 0.0);
+    printf("%-12s %8s %10s %10s %10s %10s\n", "call", "count", "avg us", "p50 us", "p99 us",
+           "max us");
+    for (int op = 0; op < NUM_OPS; op++) {
+        size_t count = durations[op].size();
+        if (count == 0) {
+            continue;
+        }
+        nsecs_t *samples = durations[op].editArray();
+        qsort(samples, count, sizeof(nsecs_t), compareDurations);
+        nsecs_t total = 0;
+        for (size_t i = 0; i < count; i++) {
+            total += samples[i];
+        }
+        printf("%-12s %8zu %10.1f %10.1f %10.1f %10.1f\n", sOpNames[op], count,
+               total / count / 1000.0,
+               samples[count / 2] / 1000.0,
+               samples[(count * 99) / 100] / 1000.0,
+               samples[count - 1] / 1000.0);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-c audio_policy.conf] [-n iterations] [-d] trace\n", name);
+}
+
+static int replayMain(int argc, char **argv)
+{
+    const char *configFile = NULL;
+    int iterations = 1;
+    bool dump = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:n:d")) != -1) {
+        switch (opt) {
+        case 'c':
+            configFile = optarg;
+            break;
+        case 'n':
+            iterations = atoi(optarg);
+            break;
+        case 'd':
+            dump = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || iterations <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Vector<ReplayCall> calls;
+    if (parseTrace(argv[optind], calls) != NO_ERROR) {
+        return 1;
+    }
+
+    ReplayClient client;
+    AudioPolicyManagerBase *manager = new AudioPolicyManagerBase(&client, configFile);
+    if (manager->initCheck() != NO_ERROR) {
+        fprintf(stderr, "policy manager initialization failed\n");
+        delete manager;
+        return 1;
+    }
+    for (int stream = 0; stream < AudioSystem::NUM_STREAM_TYPES; stream++) {
+        manager->initStreamVolume((AudioSystem::stream_type)stream, 0, 15);
+    }
+
+    audio_io_handle_t slots[MAX_SLOTS];
+    memset(slots, 0, sizeof(slots));
+    size_t opCount[NUM_OPS];
+    memset(opCount, 0, sizeof(opCount));
+    for (size_t j = 0; j < calls.size(); j++) {
+        opCount[calls[j].mOp]++;
+    }
+    Vector<nsecs_t> durations[NUM_OPS];
+    for (int op = 0; op < NUM_OPS; op++) {
+        durations[op].setCapacity(opCount[op] * iterations);
+    }
+
+    nsecs_t start = systemTime();
+    for (int i = 0; i < iterations; i++) {
+        for (size_t j = 0; j < calls.size(); j++) {
+            const ReplayCall& call = calls[j];
+            nsecs_t callStart = systemTime();
+            replayCall(manager, call, slots);
+            durations[call.mOp].add(systemTime() - callStart);
+        }
+    }
+    nsecs_t elapsed = systemTime() - start;
+
+    report(durations, elapsed, calls.size() * iterations);
+    if (dump) {
+        fflush(stdout);
+        manager->dump(STDOUT_FILENO);
+    }
+    delete manager;
+    return 0;
+}
+
+}; // namespace android_audio_legacy
+
+int main(int argc, char **argv)
+{
+    return android_audio_legacy::replayMain(argc, argv);
+}
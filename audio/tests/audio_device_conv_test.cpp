@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2014 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <gtest/gtest.h>
+
+#include <system/audio.h>
+
+#include "../audio_device_conv.h"
+
+using namespace android_audio_legacy;
+
+namespace {
+
+// The conversion convert_audio_device() did before the byte maps: one table lookup per set bit
+uint32_t convert_audio_device_per_bit(uint32_t from_device, int from_rev, int to_rev)
+{
+    uint32_t to_device = AUDIO_DEVICE_NONE;
+    uint32_t in_bit = 0;
+
+    if (from_rev != HAL_API_REV_1_0) {
+        in_bit = from_device & AUDIO_DEVICE_BIT_IN;
+        from_device &= ~AUDIO_DEVICE_BIT_IN;
+    }
+
+    while (from_device) {
+        uint32_t i = 31 - __builtin_clz(from_device);
+        uint32_t cur_device = (1 << i) | in_bit;
+
+        for (i = 0; i < audio_device_conv_table_size; i++) {
+            if (audio_device_conv_table[i][from_rev] == cur_device) {
+                to_device |= audio_device_conv_table[i][to_rev];
+                break;
+            }
+        }
+        from_device &= ~cur_device;
+    }
+    return to_device;
+}
+
+} // namespace
+
+TEST(AudioDeviceConvTest, SingleBitsMatchPerBitConversion) {
+    for (uint32_t bit = 0; bit < 32; bit++) {
+        uint32_t device = 1U << bit;
+        EXPECT_EQ(convert_audio_device_per_bit(device, HAL_API_REV_1_0, HAL_API_REV_2_0),
+                  convert_audio_device(device, HAL_API_REV_1_0, HAL_API_REV_2_0))
+                << "1.0 device 0x" << std::hex << device;
+        EXPECT_EQ(convert_audio_device_per_bit(device, HAL_API_REV_2_0, HAL_API_REV_1_0),
+                  convert_audio_device(device, HAL_API_REV_2_0, HAL_API_REV_1_0))
+                << "2.0 device 0x" << std::hex << device;
+        device |= AUDIO_DEVICE_BIT_IN;
+        EXPECT_EQ(convert_audio_device_per_bit(device, HAL_API_REV_2_0, HAL_API_REV_1_0),
+                  convert_audio_device(device, HAL_API_REV_2_0, HAL_API_REV_1_0))
+                << "2.0 device 0x" << std::hex << device;
+    }
+}
+
+TEST(AudioDeviceConvTest, RandomMasksMatchPerBitConversion) {
+    srand(1);
+    for (int i = 0; i < 100000; i++) {
+        uint32_t device = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+        EXPECT_EQ(convert_audio_device_per_bit(device, HAL_API_REV_1_0, HAL_API_REV_2_0),
+                  convert_audio_device(device, HAL_API_REV_1_0, HAL_API_REV_2_0))
+                << "1.0 device 0x" << std::hex << device;
+        EXPECT_EQ(convert_audio_device_per_bit(device, HAL_API_REV_2_0, HAL_API_REV_1_0),
+                  convert_audio_device(device, HAL_API_REV_2_0, HAL_API_REV_1_0))
+                << "2.0 device 0x" << std::hex << device;
+    }
+}
+
+TEST(AudioDeviceConvTest, TableDevicesRoundTrip) {
+    for (size_t i = 0; i < audio_device_conv_table_size; i++) {
+        uint32_t legacy = audio_device_conv_table[i][HAL_API_REV_1_0];
+        uint32_t device = audio_device_conv_table[i][HAL_API_REV_2_0];
+        EXPECT_EQ(device, convert_audio_device(legacy, HAL_API_REV_1_0, HAL_API_REV_2_0))
+                << "1.0 device 0x" << std::hex << legacy;
+        EXPECT_EQ(legacy, convert_audio_device(device, HAL_API_REV_2_0, HAL_API_REV_1_0))
+                << "2.0 device 0x" << std::hex << device;
+    }
+}
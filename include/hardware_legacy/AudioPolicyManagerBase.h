@@ -72,7 +72,9 @@ class AudioPolicyManagerBase: public AudioPolicyInterface
 {
 
 public:
-                AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface);
+                // configFile overrides the platform audio_policy.conf, e.g. for offline replay
+                AudioPolicyManagerBase(AudioPolicyClientInterface *clientInterface,
+                                       const char *configFile = NULL);
         virtual ~AudioPolicyManagerBase();
 
         // AudioPolicyInterface
@@ -137,6 +139,10 @@ public:
         virtual status_t unregisterEffect(int id);
         virtual status_t setEffectEnabled(int id, bool enabled);
 
+        // isStreamActive(), isStreamActiveRemotely(), isSourceActive() and getDevicesForStream()
+        // read the current state. Once enableQueryState() was called, they read the state
+        // published by publishQueryState() instead and can be called concurrently with the other
+        // policy methods, except from within a policy method.
         virtual bool isStreamActive(int stream, uint32_t inPastMs = 0) const;
         // return whether a stream is playing remotely, override to change the definition of
         //   local/remote playback, used for instance by notification manager to not make
@@ -160,9 +166,21 @@ protected:
             NUM_STRATEGIES
         };
 
+        // policy entry points for which decision latency is measured
+        enum policy_entry_point {
+            ENTRY_GET_OUTPUT,
+            ENTRY_START_OUTPUT,
+            ENTRY_STOP_OUTPUT,
+            ENTRY_SET_DEVICE_CONNECTION_STATE,
+            ENTRY_SET_PHONE_STATE,
+            ENTRY_SET_FORCE_USE,
+            NUM_ENTRY_POINTS
+        };
+
         // 4 points to define the volume attenuation curve, each characterized by the volume
         // index (from 0 to 100) at which they apply, and the attenuation in dB at that index.
         // we use 100 steps to avoid rounding errors when computing the volume in volIndexToAmpl()
+        // Curves defined in the volumes section of audio_policy.conf can have any number of points.
 
         enum { VOLMIN = 0, VOLKNEE1 = 1, VOLKNEE2 = 2, VOLMAX = 3, VOLCNT = 4};
 
@@ -228,6 +246,39 @@ protected:
             HwModule *mModule;                     // audio HW module exposing this I/O stream
         };
 
+        // capability index over the output or input profiles of all HW modules.
+        // Profile i in declaration order is represented by bit i of a profile set and each
+        // sampling rate, format, channel mask and device bit maps to the set of profiles
+        // supporting it: finding a compatible profile is a few ANDs of these sets.
+        class ProfileIndex
+        {
+        public:
+            ProfileIndex();
+
+            void build(const Vector <HwModule *>& hwModules, bool output);
+
+            // returns the first profile compatible with the specified parameters (see
+            // IOProfile::isCompatibleProfile()) on a loaded HW module. If availableDevices
+            // is not AUDIO_DEVICE_NONE, the profile must also support one of these devices.
+            IOProfile *find(audio_devices_t device,
+                            uint32_t samplingRate,
+                            uint32_t format,
+                            uint32_t channelMask,
+                            audio_output_flags_t flags,
+                            audio_devices_t availableDevices) const;
+
+            // max number of profiles that can be indexed. Above this, find() falls back to
+            // a linear search.
+            static const size_t MAX_PROFILES = 64;
+
+            Vector <IOProfile *> mProfiles;  // indexed profiles in declaration order
+            bool mIndexed;                   // false if more than MAX_PROFILES profiles
+            DefaultKeyedVector<uint32_t, uint64_t> mSamplingRates; // profiles per sampling rate
+            DefaultKeyedVector<uint32_t, uint64_t> mFormats;       // profiles per format
+            DefaultKeyedVector<uint32_t, uint64_t> mChannelMasks;  // profiles per channel mask
+            uint64_t mDevices[32];                                 // profiles per device bit
+        };
+
         // default volume curve
         static const VolumeCurvePoint sDefaultVolumeCurve[AudioPolicyManagerBase::VOLCNT];
         // default volume curve for media strategy
@@ -256,6 +307,8 @@ protected:
 
             audio_devices_t device() const;
             void changeRefCount(AudioSystem::stream_type stream, int delta);
+            // store time at which the stream was stopped - see isStreamActive()
+            void setStopTime(AudioSystem::stream_type stream, nsecs_t sysTime);
 
             bool isDuplicated() const { return (mOutput1 != NULL && mOutput2 != NULL); }
             audio_devices_t supportedDevices();
@@ -278,6 +331,12 @@ protected:
             audio_devices_t mDevice;                   // current device this output is routed to
             uint32_t mRefCount[AudioSystem::NUM_STREAM_TYPES]; // number of streams of each type using this output
             nsecs_t mStopTime[AudioSystem::NUM_STREAM_TYPES];
+            // activity per strategy maintained by changeRefCount() and setStopTime() so that
+            // isStrategyActive() does not need to scan all streams
+            uint32_t mStrategyRefCount[NUM_STRATEGIES]; // sum of mRefCount for streams of a strategy
+            nsecs_t mStrategyStopTime[NUM_STRATEGIES];  // last stop time for streams of a strategy
+            uint32_t mActiveRefCount;                   // sum of mRefCount for all streams
+            nsecs_t mLastStopTime;                      // last stop time for any stream
             AudioOutputDescriptor *mOutput1;    // used by duplicated outputs: first output
             AudioOutputDescriptor *mOutput2;    // used by duplicated outputs: second output
             float mCurVolume[AudioSystem::NUM_STREAM_TYPES];   // current stream volume
@@ -286,6 +345,8 @@ protected:
             bool mStrategyMutedByDevice[NUM_STRATEGIES]; // strategies muted because of incompatible
                                                 // device selection. See checkDeviceMuteStrategies()
             uint32_t mDirectOpenCount; // number of clients using this output (direct outputs only)
+            bool mHasOffloadInfo;               // true if opened with offload parameters
+            audio_offload_info_t mOffloadInfo;  // offload parameters, valid if mHasOffloadInfo
         };
 
         // descriptor for audio inputs. Used to maintain current configuration of each opened audio input
@@ -314,14 +375,33 @@ protected:
             StreamDescriptor();
 
             int getVolumeIndex(audio_devices_t device);
+            // device must be a single output device or AUDIO_DEVICE_OUT_DEFAULT
+            void setVolumeIndex(audio_devices_t device, int index);
+            // removes all device specific indexes, keeping AUDIO_DEVICE_OUT_DEFAULT index
+            void clearVolumeIndexes();
+            // rebuilds mVolumeTable[] from mVolumeCurve[], mIndexMin and mIndexMax.
+            // Should be called each time one of them changes: until then volIndexToAmpl()
+            // computes the amplification from the curve.
+            void updateVolumeTables();
+            // true if mVolumeTable[category] was built from the current curve and index range
+            bool isVolumeTableValid(int category) const;
             void dump(int fd);
 
             int mIndexMin;      // min volume index
             int mIndexMax;      // max volume index
-            KeyedVector<audio_devices_t, int> mIndexCur;   // current volume index per device
+            int mIndexCur[32];  // current volume index per device, indexed by device bit position
+            audio_devices_t mIndexCurDevices; // devices with a valid entry in mIndexCur
+                                              // always includes AUDIO_DEVICE_OUT_DEFAULT
             bool mCanBeMuted;   // true is the stream can be muted
 
             const VolumeCurvePoint *mVolumeCurve[DEVICE_CATEGORY_CNT];
+            size_t mVolumeCurveSize[DEVICE_CATEGORY_CNT];  // number of points in mVolumeCurve[]
+            // amplification per volume index from mIndexMin to mIndexMax for each device category
+            Vector <float> mVolumeTable[DEVICE_CATEGORY_CNT];
+            // curve and index range mVolumeTable[] was built from
+            const VolumeCurvePoint *mVolumeTableCurve[DEVICE_CATEGORY_CNT];
+            int mVolumeTableIndexMin;
+            int mVolumeTableIndexMax;
         };
 
         // stream descriptor used for volume control
@@ -330,6 +410,8 @@ protected:
         public:
 
             status_t dump(int fd);
+            // true for a media effect that cannot run on offloaded outputs
+            bool preventsOffload() const;
 
             int mIo;                // io the effect is attached to
             routing_strategy mStrategy; // routing strategy the effect is associated to
@@ -338,7 +420,150 @@ protected:
             bool mEnabled;              // enabled state: CPU load being used or not
         };
 
-        void addOutput(audio_io_handle_t id, AudioOutputDescriptor *outputDesc);
+        // resources used by the effects registered on one io
+        class EffectIoUsage
+        {
+        public:
+            EffectIoUsage() : mEffectCount(0), mEnabledCount(0), mCpuLoad(0), mMemory(0) {}
+
+            uint32_t mEffectCount;      // registered effects
+            uint32_t mEnabledCount;     // enabled effects
+            uint32_t mCpuLoad;          // CPU load of enabled effects in 0.1 MIPS
+            uint32_t mMemory;           // memory of registered effects in KB
+        };
+
+        // routing or stream volume command held by an open routing transaction
+        class RoutingCommand
+        {
+        public:
+            audio_io_handle_t mOutput;  // output the command is sent to
+            int mStream;                // stream for a volume command, -1 for a routing command
+            audio_devices_t mDevice;    // new device for a routing command
+            float mVolume;              // new volume for a volume command
+            int mDelayMs;               // delay requested by the caller
+        };
+
+        // direct output released by its last client and kept open in standby for reuse
+        class ParkedOutput
+        {
+        public:
+            audio_io_handle_t mId;          // output handle
+            AudioOutputDescriptor *mDesc;   // output descriptor, not in mOutputs while parked
+            nsecs_t mParkTime;              // time the output was parked
+        };
+
+        // policy state read by the query methods without the policy lock
+        class QueryState
+        {
+        public:
+            uint32_t mStreamRefCount[AudioSystem::NUM_STREAM_TYPES];  // active tracks, all outputs
+            nsecs_t mStreamStopTime[AudioSystem::NUM_STREAM_TYPES];   // last stop time, all outputs
+            uint32_t mRemoteRefCount[AudioSystem::NUM_STREAM_TYPES];  // same on remote outputs
+            nsecs_t mRemoteStopTime[AudioSystem::NUM_STREAM_TYPES];
+            audio_devices_t mDeviceForStrategy[NUM_STRATEGIES];
+            uint32_t mActiveSources;    // bit (1 << source) set for each active input source
+            bool mHotwordActive;        // an AUDIO_SOURCE_HOTWORD input is active
+        };
+
+        // latency histogram with power of 2 microsecond buckets: bucket 0 counts calls shorter
+        // than 2us, bucket i calls in [2^i, 2^(i+1)) us and the last bucket all longer calls.
+        class LatencyHistogram
+        {
+        public:
+            LatencyHistogram();
+
+            void add(nsecs_t duration);
+            void dump(int fd, const char *name);
+
+            static const int NUM_BUCKETS = 20;
+
+            uint32_t mBuckets[NUM_BUCKETS];
+            uint32_t mCount;    // number of calls measured
+            nsecs_t mTotal;     // sum of all call durations
+            nsecs_t mMax;       // longest call duration
+        };
+
+        // measures the time spent in a policy entry point if statistics are enabled
+        class AutoLatencyTimer
+        {
+        public:
+            AutoLatencyTimer(AudioPolicyManagerBase *manager, policy_entry_point entry)
+                : mManager(manager), mEntry(entry),
+                  mStart(manager->mStatsEnabled ? systemTime() : 0) {}
+            ~AutoLatencyTimer() {
+                if (mManager->mStatsEnabled) {
+                    mManager->mLatency[mEntry].add(systemTime() - mStart);
+                }
+            }
+        private:
+            AudioPolicyManagerBase *mManager;
+            policy_entry_point mEntry;
+            nsecs_t mStart;
+        };
+
+        // opens a routing transaction on construction and commits it on destruction
+        class AutoRoutingTransaction
+        {
+        public:
+            AutoRoutingTransaction(AudioPolicyManagerBase *manager)
+                : mManager(manager) { mManager->beginRoutingTransaction(); }
+            ~AutoRoutingTransaction() { mManager->commitRoutingTransaction(); }
+        private:
+            AudioPolicyManagerBase *mManager;
+        };
+
+        // marks the calling thread as running a policy method and publishes the query state
+        // when the outermost policy call returns
+        class AutoQueryStateUpdate
+        {
+        public:
+            AutoQueryStateUpdate(AudioPolicyManagerBase *manager) : mManager(manager) {
+                mManager->enterPolicyCall();
+            }
+            ~AutoQueryStateUpdate() { mManager->exitPolicyCall(); }
+        private:
+            AudioPolicyManagerBase *mManager;
+        };
+
+        // makes the query methods read the state published by publishQueryState(). Called from
+        // the constructor of policies whose methods all call the base class method or
+        // publishQueryState(): the published state is otherwise stale.
+        void enableQueryState();
+        // rebuilds the state read by the query methods from mOutputs, mInputs and
+        // mDeviceForStrategy. Must be called by derived policies after changing stream or input
+        // activity outside of the base class methods.
+        void publishQueryState();
+        // copies the last published query state, retrying while it is being updated
+        void readQueryState(QueryState& state) const;
+        // true if called by the thread running a policy method that changes the query state
+        bool isInPolicyCall() const;
+        // true if the query methods must read the published state rather than the current one
+        bool readsQueryState() const;
+        void enterPolicyCall();
+        void exitPolicyCall();
+        // stream activity on current outputs state, read by the query methods within a policy call
+        bool isStreamActiveOnOutputs(int stream, uint32_t inPastMs, bool remoteOnly) const;
+
+        // adds or removes an effect from mEffectSessions and mEffectIoUsage
+        void addEffectToIndex(int id, const EffectDescriptor *pDesc);
+        void removeEffectFromIndex(int id, const EffectDescriptor *pDesc);
+        void addEffectIoUsage(const EffectDescriptor *pDesc);
+        void removeEffectIoUsage(const EffectDescriptor *pDesc);
+        // updates the io of an effect moved to another output
+        void setEffectIo(EffectDescriptor *pDesc, audio_io_handle_t io);
+
+        // adds an output to mOutputs. opened is false when a parked output is reused.
+        void addOutput(audio_io_handle_t id, AudioOutputDescriptor *outputDesc, bool opened = true);
+        // removes an output from mOutputs. Does not delete the descriptor.
+        void removeOutput(audio_io_handle_t id);
+        // rebuilds mOutputSlots after mOutputs was modified
+        void updateOutputSlots();
+        // returns the descriptor of an opened output, or NULL
+        AudioOutputDescriptor *getOutputDesc(audio_io_handle_t id) const;
+        // copies mOutputs to mPreviousOutputs if an output was opened or closed since last copy
+        void snapshotOutputs();
+        // true if mOutputs differs from mPreviousOutputs
+        bool outputsChangedSinceSnapshot() const;
 
         // return the strategy corresponding to a given stream type
         static routing_strategy getStrategy(AudioSystem::stream_type stream);
@@ -354,9 +579,32 @@ protected:
         // "future" device selection (fromCache == false) when called from a context
         //  where conditions are changing (setDeviceConnectionState(), setPhoneState()...) AND
         //  before updateDevicesAndOutputs() is called.
+        // When fromCache is false, the device is read from the routing table which is only
+        // rebuilt when the policy state it depends on changes (see updateRoutingTable()).
         virtual audio_devices_t getDeviceForStrategy(routing_strategy strategy,
                                                      bool fromCache);
 
+        // policy state the routing table depends on
+        struct RoutingKey {
+            bool operator==(const RoutingKey& other) const;
+
+            audio_devices_t mAvailableOutputDevices;
+            int mPhoneState;
+            AudioSystem::forced_config mForceUse[AudioSystem::NUM_FORCE_USE];
+            bool mA2dpUsable;   // A2DP device connected, A2DP output open and not suspended
+        };
+
+        // fills key with the current policy state
+        void getRoutingKey(RoutingKey *key);
+
+        // rebuilds the routing table (mRoutingTable[]) if the policy state changed since
+        // it was last built.
+        void updateRoutingTable();
+
+        // determines the device for a strategy according to the current routing key.
+        // Only called by updateRoutingTable().
+        audio_devices_t computeDeviceForStrategy(routing_strategy strategy);
+
         // change the route of the specified output. Returns the number of ms we have slept to
         // allow new routing to take effect in certain cases.
         uint32_t setOutputDevice(audio_io_handle_t output,
@@ -364,6 +612,24 @@ protected:
                              bool force = false,
                              int delayMs = 0);
 
+        // routing transactions: while a transaction is open, routing and stream volume commands
+        // are queued instead of being sent to the audio HAL. A command replaces a pending one
+        // for the same output, stream and delay in the queue. Commands are sent in queue order
+        // when the outermost transaction is committed.
+        void beginRoutingTransaction();
+        void commitRoutingTransaction();
+        // sends all pending commands without closing the transaction
+        void flushRoutingCommands();
+        // drops pending commands for an output about to be closed
+        void discardRoutingCommands(audio_io_handle_t output);
+        // send a command or queue it if a transaction is open
+        void sendRoutingCommand(audio_io_handle_t output, audio_devices_t device, int delayMs);
+        void sendVolumeCommand(audio_io_handle_t output, int stream, float volume, int delayMs);
+        void queueRoutingCommand(const RoutingCommand& command);
+
+        // dump policy statistics: counters and, if enabled, entry point latency histograms
+        void dumpStats(int fd);
+
         // select input device corresponding to requested audio source
         virtual audio_devices_t getDeviceForInputSource(int inputSource);
 
@@ -374,6 +640,12 @@ protected:
 
         // initialize volume curves for each strategy and device category
         void initializeVolumeCurves();
+        // returns the curve configured in audio_policy.conf for a stream and device category,
+        // or the default one
+        const VolumeCurvePoint *getVolumeCurve(int stream, device_category category,
+                                               size_t *size) const;
+        // applies the volume curves of curveStream to stream and rebuilds its volume tables
+        void setStreamVolumeCurves(int stream, int curveStream);
 
         // compute the actual volume for a given stream according to the requested index and a particular
         // device
@@ -419,9 +691,35 @@ protected:
                                        AudioSystem::device_connection_state state,
                                        SortedVector<audio_io_handle_t>& outputs);
 
+        // fills the dynamic sampling rates, formats and channel masks of a direct output profile
+        // from the parameters reported by the opened output
+        void loadDynamicOutputParameters(audio_io_handle_t output, IOProfile *profile);
+        // returns the value of key in reply, or queries it alone if reply does not contain it
+        String8 getDynamicOutputParameter(audio_io_handle_t output,
+                                          AudioParameter& reply,
+                                          const char *key);
+
         // close an output and its companion duplicating output.
         void closeOutput(audio_io_handle_t output);
 
+        // moves a released direct output from mOutputs to the parked output pool.
+        // Returns false if the pool is disabled and the output must be closed.
+        bool parkOutput(audio_io_handle_t output);
+        // returns a parked output opened on profile with the requested parameters and moves it
+        // back to mOutputs, or 0. Parked outputs of the same profile with other parameters are closed.
+        audio_io_handle_t unparkOutput(IOProfile *profile,
+                                       uint32_t samplingRate,
+                                       uint32_t format,
+                                       uint32_t channelMask,
+                                       const audio_offload_info_t *offloadInfo);
+        // closes parked outputs older than mParkedOutputTtlMs, or all of them if all is true.
+        // Called on entry of the output policy methods: outputs are only closed by the thread
+        // running the policy.
+        void closeParkedOutputs(bool all);
+        void closeParkedOutput(size_t index);
+        static bool isSameOffloadInfo(const AudioOutputDescriptor *desc,
+                                      const audio_offload_info_t *offloadInfo);
+
         // checks and if necessary changes outputs used for all strategies.
         // must be called every time a condition that affects the output choice for a given strategy
         // changes: connected device, phone state, force use...
@@ -468,7 +766,7 @@ protected:
         static audio_devices_t getDeviceForVolume(audio_devices_t device);
 
         SortedVector<audio_io_handle_t> getOutputsForDevice(audio_devices_t device,
-                        DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> openOutputs);
+                        const DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *>& openOutputs);
         bool vectorsEqual(SortedVector<audio_io_handle_t>& outputs1,
                                            SortedVector<audio_io_handle_t>& outputs2);
 
@@ -491,6 +789,9 @@ protected:
                                                        uint32_t format,
                                                        uint32_t channelMask,
                                                        audio_output_flags_t flags);
+        // rebuilds the output and input profile indexes if the profiles changed since they
+        // were last built.
+        void updateProfileIndex();
 
         audio_io_handle_t selectOutputForEffects(const SortedVector<audio_io_handle_t>& outputs);
 
@@ -514,7 +815,19 @@ protected:
         void loadHwModule(cnode *root);
         void loadHwModules(cnode *root);
         void loadGlobalConfig(cnode *root);
+        void loadVolumeCurves(cnode *root);
+        // parses "<index>,<dB>|<index>,<dB>|..." into curve
+        static status_t parseVolumeCurve(char *value, Vector <VolumeCurvePoint>& curve);
         status_t loadAudioPolicyConfig(const char *path);
+        // compiled configuration cache (see AUDIO_POLICY_CONFIG_CACHE_DIR)
+        static String8 getAudioPolicyConfigCachePath(const char *path);
+        static uint32_t hashAudioPolicyConfig(const char *data, size_t size);
+        status_t loadAudioPolicyConfigCache(const char *cachePath,
+                                            uint32_t configSize,
+                                            uint32_t configHash);
+        void writeAudioPolicyConfigCache(const char *cachePath,
+                                         uint32_t configSize,
+                                         uint32_t configHash);
         void defaultAudioPolicyConfig(void);
 
 
@@ -525,6 +838,12 @@ protected:
         // copy of mOutputs before setDeviceConnectionState() opens new outputs
         // reset to mOutputs when updateDevicesAndOutputs() is called.
         DefaultKeyedVector<audio_io_handle_t, AudioOutputDescriptor *> mPreviousOutputs;
+        // index in mOutputs of an output whose handle modulo OUTPUT_SLOT_CNT is the slot, -1 if
+        // none. getOutputDesc() checks the key before use and searches mOutputs on a miss.
+        static const uint32_t OUTPUT_SLOT_CNT = 32;
+        mutable ssize_t mOutputSlots[OUTPUT_SLOT_CNT];
+        uint32_t mOutputsGeneration;            // incremented when an output is added or removed
+        uint32_t mPreviousOutputsGeneration;    // mOutputsGeneration when mPreviousOutputs was copied
         DefaultKeyedVector<audio_io_handle_t, AudioInputDescriptor *> mInputs;     // list of input descriptors
         audio_devices_t mAvailableOutputDevices; // bit field of all available output devices
         audio_devices_t mAvailableInputDevices; // bit field of all available input devices
@@ -534,12 +853,17 @@ protected:
         AudioSystem::forced_config mForceUse[AudioSystem::NUM_FORCE_USE];   // current forced use configuration
 
         StreamDescriptor mStreams[AudioSystem::NUM_STREAM_TYPES];           // stream descriptors for volume control
+        // volume curves from audio_policy.conf, empty when the default curve is used
+        Vector <VolumeCurvePoint> mConfigVolumeCurves[AUDIO_STREAM_CNT][DEVICE_CATEGORY_CNT];
         String8 mA2dpDeviceAddress;                                         // A2DP device MAC address
         String8 mScoDeviceAddress;                                          // SCO device MAC address
         String8 mUsbCardAndDevice; // USB audio ALSA card and device numbers:
                                    // card=<card_number>;device=<><device_number>
         bool    mLimitRingtoneVolume;                                       // limit ringtone volume to music volume if headset connected
         audio_devices_t mDeviceForStrategy[NUM_STRATEGIES];
+        audio_devices_t mRoutingTable[NUM_STRATEGIES]; // device per strategy for mRoutingKey
+        RoutingKey mRoutingKey;                        // policy state mRoutingTable was built for
+        bool    mRoutingTableValid;                    // false until mRoutingTable is first built
         float   mLastVoiceVolume;                                           // last voice volume value sent to audio HAL
 
         // Maximum CPU load allocated to audio effects in 0.1 MIPS (ARMv5TE, 0 WS memory) units
@@ -549,6 +873,9 @@ protected:
         uint32_t mTotalEffectsCpuLoad; // current CPU load used by effects
         uint32_t mTotalEffectsMemory;  // current memory used by effects
         KeyedVector<int, EffectDescriptor *> mEffects;  // list of registered audio effects
+        KeyedVector<int, SortedVector<int> > mEffectSessions;   // effect IDs per audio session
+        KeyedVector<int, EffectIoUsage> mEffectIoUsage;         // effect resources per io
+        uint32_t mNonOffloadableEffectsEnabled; // enabled effects for which preventsOffload() is true
         bool    mA2dpSuspended;  // true if A2DP output is suspended
         bool mHasA2dp; // true on platforms with support for bluetooth A2DP
         bool mHasUsb; // true on platforms with support for USB audio
@@ -562,6 +889,29 @@ protected:
         bool isCaptureRateChange;
 
         Vector <HwModule *> mHwModules;
+        ProfileIndex mOutputProfileIndex;
+        ProfileIndex mInputProfileIndex;
+        bool mProfileIndexValid; // false when profiles were added or their parameters changed
+        int mRoutingTransactionDepth;           // number of nested open routing transactions
+        Vector <RoutingCommand> mRoutingCommands; // commands queued by the open transaction
+        Vector <ParkedOutput> mParkedOutputs;     // parked direct outputs, oldest first
+        uint32_t mMaxParkedOutputs;     // pool size from audio.policy.parked_outputs, 0 disables it
+        uint32_t mParkedOutputTtlMs;    // parked output lifetime from audio.policy.parked_output_ttl_ms
+        bool mQueryStateEnabled;        // set by enableQueryState()
+        QueryState mQueryState;         // written by publishQueryState() under mQueryStateSeq
+        volatile int32_t mQueryStateSeq;    // odd while mQueryState is being written
+        volatile pid_t mPolicyTid;      // thread running a policy method, 0 if none
+        int mPolicyCallDepth;           // nested AutoQueryStateUpdate, only used by mPolicyTid
+
+        // policy statistics reported by dump()
+        bool mStatsEnabled;     // latency measurement enabled by property audio.policy.stats
+        LatencyHistogram mLatency[NUM_ENTRY_POINTS];
+        uint32_t mOutputsOpened;            // outputs added to mOutputs
+        uint32_t mOutputsClosed;            // outputs removed from mOutputs
+        uint32_t mRoutingCommandsSent;      // routing commands sent to the audio HAL
+        uint32_t mVolumeCommandsSent;       // stream volume commands sent to the audio HAL
+        uint32_t mCommandsCoalesced;        // commands superseded in a routing transaction
+        uint32_t mParkedOutputsReused;      // direct outputs reopened from the parked pool
 
 #ifdef AUDIO_POLICY_TEST
         Mutex   mLock;
@@ -581,6 +931,9 @@ protected:
 private:
         static float volIndexToAmpl(audio_devices_t device, const StreamDescriptor& streamDesc,
                 int indexInUi);
+        // interpolates the amplification for a volume index on a volume curve
+        static float computeVolIndexToAmpl(const VolumeCurvePoint *curve, size_t curveSize,
+                int indexMin, int indexMax, int indexInUi);
         // updates device caching and output for streams that can influence the
         //    routing of notifications
         void handleNotificationRoutingForStream(AudioSystem::stream_type stream);
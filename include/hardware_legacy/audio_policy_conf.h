@@ -28,6 +28,12 @@
 #define AUDIO_POLICY_CONFIG_FILE "/system/etc/audio_policy.conf"
 #define AUDIO_POLICY_VENDOR_CONFIG_FILE "/vendor/etc/audio_policy.conf"
 
+// compiled form of the configuration file, written after it is parsed and loaded instead of
+// parsing the text file as long as the configuration file size and contents hash do not change.
+// The cache file name is the configuration file path with '/' replaced by '_'.
+#define AUDIO_POLICY_CONFIG_CACHE_DIR "/data/misc/media"
+#define AUDIO_POLICY_CONFIG_CACHE_SUFFIX ".cache"
+
 // global configuration
 #define GLOBAL_CONFIG_TAG "global_configuration"
 
@@ -36,6 +42,18 @@
 #define ATTACHED_INPUT_DEVICES_TAG "attached_input_devices"
 #define SPEAKER_DRC_ENABLED_TAG "speaker_drc_enabled"
 
+// volume curves, in a "volumes" sub section of the global configuration:
+// volumes {
+//   AUDIO_STREAM_MUSIC {
+//     speaker 1,-55.0|20,-43.0|86,-12.0|100,0.0
+//   }
+// }
+// Each device category lists "<index>,<attenuation in dB>" points by increasing index.
+#define VOLUMES_TAG "volumes"
+#define VOLUME_CURVE_HEADSET_TAG "headset"
+#define VOLUME_CURVE_SPEAKER_TAG "speaker"
+#define VOLUME_CURVE_EARPIECE_TAG "earpiece"
+
 // hw modules descriptions
 #define AUDIO_HW_MODULE_TAG "audio_hw_modules"
 